@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <mntent.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,8 @@
 #include "hotplug_devpath.h"
 #include "hotplug_setenv.h"
 #include "hotplug_socket.h"
+#include "hotplug_state.h"
+#include "hotplug_timeout.h"
 #include "udev.h"
 
 enum {
@@ -44,10 +47,14 @@ enum {
 };
 
 static int media_status = MEDIA_STATUS_NO_MEDIA;
+static volatile int print_stats;
 static const int interval_in_seconds = 2;
 
 static const char *bdpoll_vars[] = {
 	"DEVPATH",
+#if defined(HOTPLUG_SOCKET_EXTENDED)
+	"SUBSYSTEM",
+#endif
 	"X_E2_MEDIA_STATUS",
 	NULL,
 };
@@ -55,8 +62,19 @@ static const char *bdpoll_vars[] = {
 static void bdpoll_notify(const char devpath[])
 {
 	setenv("DEVPATH", devpath, 1);
+#if defined(HOTPLUG_SOCKET_EXTENDED)
+	setenv("SUBSYSTEM", "block", 1);
+#endif
 	hotplug_setenv_bool("X_E2_MEDIA_STATUS", media_status == MEDIA_STATUS_GOT_MEDIA);
-	hotplug_socket_send_env(bdpoll_vars);
+	hotplug_state_media(devpath, media_status == MEDIA_STATUS_GOT_MEDIA);
+	/* an older, still queued status of the device is obsolete */
+	hotplug_socket_send_env_latest(bdpoll_vars, "DEVPATH");
+}
+
+static void sig_handler(int signum)
+{
+	if (signum == SIGUSR1)
+		print_stats = 1;
 }
 
 static bool is_mounted(const char device_file[])
@@ -196,6 +214,7 @@ int bdpoll(int argc, char *argv[], char *envp[])
 	const char *devpath;
 	bool is_cdrom = false;
 	bool support_media_changed = false;
+	struct hotplug_timer poll_timer = { .slot = 0 };
 	int opt;
 
 	while ((opt = getopt(argc, argv, "cm")) != -1) {
@@ -223,10 +242,31 @@ int bdpoll(int argc, char *argv[], char *envp[])
 		err("could not parse devpath");
 	}
 
+	hotplug_socket_persistent(true);
+	signal(SIGUSR1, sig_handler);
+	log_level_signal();
+
+	/* the initial status is only recorded, consumers are told about changes */
+	if (!poll_for_media(devnode, is_cdrom, support_media_changed))
+		hotplug_state_media(devpath, media_status == MEDIA_STATUS_GOT_MEDIA);
+	else
+		bdpoll_notify(devpath);
+
+	/* the interval does not stretch by the time each poll takes */
+	hotplug_timer_add(&poll_timer, interval_in_seconds * 1000, interval_in_seconds * 1000);
+
 	for (;;) {
+		if (print_stats) {
+			print_stats = 0;
+			hotplug_socket_print_stats();
+		}
+		/* deliver what a slow consumer did not take yet, meanwhile */
+		hotplug_socket_flush(hotplug_timer_left(&poll_timer));
+		if (hotplug_timer_wait(-1, 0) != &poll_timer)
+			continue;
+
 		if (poll_for_media(devnode, is_cdrom, support_media_changed))
 			bdpoll_notify(devpath);
-		sleep(interval_in_seconds);
 	}
 
 	return EXIT_SUCCESS;
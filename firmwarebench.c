@@ -0,0 +1,201 @@
+/*
+    firmwarebench.c
+
+    Measures the firmware upload throughput of the sendfile and mmap
+    methods for several chunk sizes, into a real or a fake sysfs data file.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "firmwarebench.h"
+#include "module_firmware.h"
+#include "udev.h"
+
+static const size_t default_chunks[] = {
+	4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024,
+};
+
+static const char *method_name[] = {
+	[FIRMWARE_UPLOAD_SENDFILE] = "sendfile",
+	[FIRMWARE_UPLOAD_MMAP] = "mmap",
+};
+
+static const char *format_name[] = {
+	[FIRMWARE_GZ] = "gunzip",
+	[FIRMWARE_XZ] = "unxz",
+};
+
+/* compressed firmware is benchmarked by decompression, compare with the plain file */
+static enum firmware_format bench_format(const char *path)
+{
+	size_t len = strlen(path);
+
+	if (len > 3 && strcmp(&path[len - 3], ".gz") == 0)
+		return FIRMWARE_GZ;
+	if (len > 3 && strcmp(&path[len - 3], ".xz") == 0)
+		return FIRMWARE_XZ;
+	return FIRMWARE_PLAIN;
+}
+
+static unsigned long long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* best of rounds, in microseconds */
+static long long bench_run(const char *data, int src_fd, off_t size, size_t chunk,
+			   enum firmware_format format, enum firmware_upload *method,
+			   unsigned int rounds, int cold)
+{
+	unsigned long long start, best = 0;
+	struct stat st;
+	unsigned int i;
+	int dst_fd;
+	int ret;
+
+	for (i = 0; i < rounds; i++) {
+		dst_fd = open(data, O_WRONLY | O_CREAT, 0644);
+		if (dst_fd == -1) {
+			fprintf(stderr, "%s: %s\n", data, strerror(errno));
+			return -1;
+		}
+		if (fstat(dst_fd, &st) == 0 && S_ISREG(st.st_mode))
+			ftruncate(dst_fd, 0);
+		if (cold)
+			posix_fadvise(src_fd, 0, 0, POSIX_FADV_DONTNEED);
+
+		start = now_usec();
+		if (format != FIRMWARE_PLAIN)
+			ret = firmware_decompress(dst_fd, src_fd, chunk, format, 0);
+		else
+			ret = firmware_upload(dst_fd, src_fd, size, chunk, method);
+		start = now_usec() - start;
+		close(dst_fd);
+
+		if (ret == -1) {
+			fprintf(stderr, "upload failed\n");
+			return -1;
+		}
+		if (i == 0 || start < best)
+			best = start;
+	}
+
+	return best;
+}
+
+int firmwarebench(int argc, char *argv[], char *envp[])
+{
+	enum firmware_upload method, used;
+	enum firmware_format format;
+	struct stat data_st;
+	const size_t *chunks = default_chunks;
+	unsigned int nchunks = sizeof(default_chunks) / sizeof(default_chunks[0]);
+	unsigned int rounds = 5;
+	size_t chunk;
+	struct stat st;
+	long long usec;
+	int cold = 0;
+	unsigned int i;
+	int option;
+	int src_fd;
+
+	static const struct option options[] = {
+		{ "chunk", 1, NULL, 'c' },
+		{ "rounds", 1, NULL, 'r' },
+		{ "cold", 0, NULL, 'C' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "c:r:Ch", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			chunks = &chunk;
+			nchunks = 1;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			if (rounds == 0)
+				rounds = 1;
+			break;
+		case 'C':
+			cold = 1;
+			break;
+		case 'h':
+			printf("Usage: firmwarebench [--chunk=<bytes>] [--rounds=<n>] [--cold] <firmware> <data>\n"
+			       "  --chunk     only this chunk size instead of 4k to 1M\n"
+			       "  --rounds    report the best of n uploads, 5 by default\n"
+			       "  --cold      drop the firmware from the page cache before each upload\n"
+			       "  <firmware> ending in .gz or .xz is decompressed while uploading\n"
+			       "  --help\n"
+			       "  <data> is /sys$DEVPATH/data or a regular file, which is truncated\n\n");
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "firmware and data file required\n");
+		return 1;
+	}
+
+	src_fd = open(argv[optind], O_RDONLY);
+	if (src_fd == -1 || fstat(src_fd, &st) == -1) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	format = bench_format(argv[optind]);
+
+	/* MB/s of the uploaded, decompressed data */
+	printf("%-8s %8s %10s %10s\n", "method", "chunk", "usec", "MB/s");
+	for (method = FIRMWARE_UPLOAD_SENDFILE; method <= FIRMWARE_UPLOAD_MMAP; method++) {
+		for (i = 0; i < nchunks; i++) {
+			used = method;
+			usec = bench_run(argv[optind + 1], src_fd, st.st_size, chunks[i], format, &used,
+					 rounds, cold);
+			if (usec == -1 || stat(argv[optind + 1], &data_st) == -1) {
+				close(src_fd);
+				return 1;
+			}
+			if (!S_ISREG(data_st.st_mode))
+				data_st.st_size = st.st_size;
+			printf("%-8s %8zu %10lld %10.1f%s\n",
+			       format != FIRMWARE_PLAIN ? format_name[format] : method_name[method],
+			       chunks[i], usec, usec ? (double)data_st.st_size / usec : 0.0,
+			       used != method ? " (fell back to mmap)" : "");
+		}
+		if (format != FIRMWARE_PLAIN)
+			break;
+	}
+
+	close(src_fd);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef HOTPLUG_FIRMWAREBENCH_H
+#define HOTPLUG_FIRMWAREBENCH_H
+
+int firmwarebench(int argc, char *argv[], char *envp[]);
+
+#endif
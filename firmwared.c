@@ -0,0 +1,378 @@
+/*
+    firmwared.c
+
+    Serves the firmware requests of the kernel concurrently, each within
+    a deadline, and keeps the upload times per firmware.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#define _GNU_SOURCE	/* for ppoll() */
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "firmwared.h"
+#include "hotplug_netlink.h"
+#include "hotplug_pidfile.h"
+#include "hotplug_timeout.h"
+#include "hotplug_uevent.h"
+#include "module_firmware.h"
+#include "udev.h"
+#include "udevd.h"
+
+/* more requests wait in the receive buffer of the netlink socket */
+#define FIRMWARED_JOBS		8
+#define FIRMWARED_NAMES		32
+
+struct fw_request {
+	pid_t pid;				/* 0 if the slot is free */
+	unsigned long long start;
+	unsigned long long deadline;
+	char devpath[PATH_SIZE];
+	char firmware[NAME_SIZE];
+};
+
+struct fw_stats {
+	char firmware[NAME_SIZE];
+	unsigned long loaded;
+	unsigned long failed;
+	unsigned long expired;
+	unsigned long long total_ms;		/* of the loaded ones */
+	unsigned long long max_ms;
+};
+
+static struct fw_request requests[FIRMWARED_JOBS];
+static unsigned int jobs;
+static struct fw_stats stats[FIRMWARED_NAMES];
+static unsigned int deadline_ms = FIRMWARED_DEADLINE;
+static volatile int firmwared_exit;
+static volatile int print_stats;
+
+static void asmlinkage sig_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		firmwared_exit = 1;
+	else if (signum == SIGUSR1)
+		print_stats = 1;
+}
+
+/* once all slots are taken, the one of the least requested firmware is reused */
+static struct fw_stats *stats_get(const char *firmware)
+{
+	unsigned int i, least = 0;
+	unsigned long count, least_count = ULONG_MAX;
+
+	for (i = 0; i < FIRMWARED_NAMES; i++) {
+		if (stats[i].firmware[0] == '\0' || strcmp(stats[i].firmware, firmware) == 0)
+			break;
+		count = stats[i].loaded + stats[i].failed + stats[i].expired;
+		if (count < least_count) {
+			least = i;
+			least_count = count;
+		}
+	}
+	if (i == FIRMWARED_NAMES) {
+		i = least;
+		memset(&stats[i], 0x00, sizeof(stats[i]));
+	}
+	strlcpy(stats[i].firmware, firmware, sizeof(stats[i].firmware));
+	return &stats[i];
+}
+
+static void stats_print(void)
+{
+	struct fw_stats *s;
+	unsigned int i;
+
+	for (i = 0; i < FIRMWARED_NAMES && stats[i].firmware[0] != '\0'; i++) {
+		s = &stats[i];
+		info("%s: %lu loaded, avg %llu ms, max %llu ms, %lu failed, %lu expired",
+		     s->firmware, s->loaded, s->loaded ? s->total_ms / s->loaded : 0,
+		     s->max_ms, s->failed, s->expired);
+	}
+}
+
+static void request_done(struct fw_request *req, int status)
+{
+	unsigned long long ms = timeout_now() - req->start;
+	struct fw_stats *s = stats_get(req->firmware);
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		s->loaded++;
+		s->total_ms += ms;
+		if (ms > s->max_ms)
+			s->max_ms = ms;
+		info("%s: loaded into %s in %llu ms", req->firmware, req->devpath, ms);
+	} else {
+		s->failed++;
+		err("%s: loading into %s failed after %llu ms", req->firmware, req->devpath, ms);
+	}
+
+	req->pid = 0;
+	jobs--;
+}
+
+static void reap_requests(void)
+{
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < FIRMWARED_JOBS; i++) {
+			if (requests[i].pid == pid) {
+				request_done(&requests[i], status);
+				break;
+			}
+		}
+	}
+}
+
+/* cancel the requests past their deadline, returns ms until the next one or -1 */
+static int expire_requests(void)
+{
+	unsigned long long now = timeout_now();
+	unsigned long long next = 0;
+	struct fw_request *req;
+	unsigned int i;
+
+	for (i = 0; i < FIRMWARED_JOBS; i++) {
+		req = &requests[i];
+		if (req->pid == 0)
+			continue;
+		if (now < req->deadline) {
+			if (next == 0 || req->deadline < next)
+				next = req->deadline;
+			continue;
+		}
+
+		/* the loader is gone before the kernel hears about it */
+		kill(req->pid, SIGKILL);
+		waitpid(req->pid, NULL, 0);
+		firmware_cancel(req->devpath);
+		err("%s: loading into %s cancelled after %llu ms", req->firmware, req->devpath,
+		    now - req->start);
+		stats_get(req->firmware)->expired++;
+		req->pid = 0;
+		jobs--;
+	}
+
+	return next ? (int)(next - now) : -1;
+}
+
+static void start_request(const struct uevent *ev)
+{
+	const char *devpath = ev->known[UEVENT_DEVPATH];
+	const char *firmware = ev->known[UEVENT_FIRMWARE];
+	const char *timeout = ev->known[UEVENT_TIMEOUT];
+	struct fw_request *req = NULL;
+	unsigned long long deadline;
+	unsigned long kernel_timeout;
+	unsigned int i;
+	pid_t pid;
+
+	if (devpath == NULL || firmware == NULL)
+		return;
+
+	for (i = 0; i < FIRMWARED_JOBS; i++) {
+		if (requests[i].pid == 0) {
+			req = &requests[i];
+			break;
+		}
+	}
+	if (req == NULL)
+		return;
+
+	/* stay a second below the timeout of the kernel, if it is shorter */
+	deadline = deadline_ms;
+	kernel_timeout = timeout ? strtoul(timeout, NULL, 10) : 0;
+	if (kernel_timeout > 1 && (kernel_timeout - 1) * 1000 < deadline)
+		deadline = (kernel_timeout - 1) * 1000;
+
+	pid = fork();
+	if (pid == -1) {
+		err("fork failed: %s", strerror(errno));
+		firmware_cancel(devpath);
+		return;
+	}
+	if (pid == 0)
+		_exit(firmware_load(devpath, firmware));
+
+	req->pid = pid;
+	req->start = timeout_now();
+	req->deadline = req->start + deadline;
+	strlcpy(req->devpath, devpath, sizeof(req->devpath));
+	strlcpy(req->firmware, firmware, sizeof(req->firmware));
+	jobs++;
+	dbg("%s: loading into %s, pid %d", firmware, devpath, pid);
+}
+
+static void receive_requests(int sock, struct hotplug_netlink_stats *netlink_stats)
+{
+	char buf[UEVENT_BUFFER_SIZE * 2];
+	struct uevent ev;
+	ssize_t len;
+
+	while (jobs < FIRMWARED_JOBS) {
+		len = recv(sock, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				hotplug_netlink_enobufs(netlink_stats);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		buf[len] = '\0';
+		if (uevent_parse(&ev, buf, len + 1) != 0)
+			continue;
+		hotplug_netlink_account(netlink_stats, ev.known[UEVENT_SEQNUM]);
+
+		/* the filter drops everything else unless it could not be attached */
+		if (ev.known[UEVENT_SUBSYSTEM] == NULL || ev.known[UEVENT_ACTION] == NULL ||
+		    strcmp(ev.known[UEVENT_SUBSYSTEM], "firmware") != 0 ||
+		    strcmp(ev.known[UEVENT_ACTION], "add") != 0)
+			continue;
+		start_request(&ev);
+	}
+}
+
+int firmwared(int argc, char *argv[], char *envp[])
+{
+	struct hotplug_netlink_stats netlink_stats;
+	struct hotplug_netlink_filter filter;
+	struct sigaction act;
+	sigset_t mask, orig_mask;
+	struct timespec ts;
+	struct pollfd pfd;
+	char *end;
+	long value;
+	int timeout;
+	int option;
+	int sock;
+	int pid_fd;
+	int retval = 1;
+
+	static const struct option options[] = {
+		{ "deadline", 1, NULL, 'd' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "d:h", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 'd':
+			value = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || value <= 0 || value > INT_MAX) {
+				fprintf(stderr, "invalid deadline '%s'\n", optarg);
+				return 1;
+			}
+			deadline_ms = value;
+			break;
+		case 'h':
+			printf("Usage: firmwared [--deadline=<ms>] [--help]\n"
+			       "  --deadline  cancel requests after ms, %u by default\n"
+			       "              or a second before the kernel's TIMEOUT\n"
+			       "  --help\n"
+			       "  SIGUSR1 logs the upload times per firmware\n\n", FIRMWARED_DEADLINE);
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	sock = hotplug_netlink_open(HOTPLUG_NETLINK_RCVBUF, &netlink_stats);
+	if (sock == -1)
+		return 1;
+	hotplug_netlink_filter_init(&filter);
+	name_list_add(&filter.subsystem_list, "firmware", 0);
+	name_list_add(&filter.action_list, "add", 0);
+	hotplug_netlink_filter_attach(sock, &filter, &netlink_stats);
+
+	memset(&act, 0x00, sizeof(struct sigaction));
+	act.sa_handler = (void (*)(int)) sig_handler;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGUSR1, &act, NULL);
+	sigaction(SIGCHLD, &act, NULL);
+	log_level_signal();
+
+	/* children only end while waiting in ppoll */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+
+	pid_fd = pidfile_lock("firmwared");
+	if (pid_fd == -1) {
+		if (errno == EWOULDBLOCK)
+			err("firmwared is already running");
+		goto out;
+	}
+
+	while (!firmwared_exit) {
+		reap_requests();
+		timeout = expire_requests();
+		if (print_stats) {
+			print_stats = 0;
+			stats_print();
+			hotplug_netlink_print_stats(&netlink_stats);
+		}
+
+		pfd.fd = sock;
+		pfd.events = (jobs < FIRMWARED_JOBS) ? POLLIN : 0;
+		pfd.revents = 0;
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		if (ppoll(&pfd, 1, timeout < 0 ? NULL : &ts, &orig_mask) == -1 && errno != EINTR) {
+			err("poll failed: %s", strerror(errno));
+			break;
+		}
+		if (pfd.revents & (POLLIN | POLLERR))
+			receive_requests(sock, &netlink_stats);
+	}
+	retval = 0;
+
+	/* nobody takes over the outstanding requests */
+	while (jobs > 0) {
+		reap_requests();
+		timeout = expire_requests();
+		if (jobs > 0 && timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			ppoll(NULL, 0, &ts, &orig_mask);
+		}
+	}
+	stats_print();
+	pidfile_unlink("firmwared");
+	close(pid_fd);
+out:
+	hotplug_netlink_filter_cleanup(&filter);
+	close(sock);
+	return retval;
+}
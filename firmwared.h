@@ -0,0 +1,13 @@
+#ifndef HOTPLUG_FIRMWARED_H
+#define HOTPLUG_FIRMWARED_H
+
+/*
+ * While firmwared runs, its pid in /var/run/firmwared.pid tells hotplug
+ * to leave the firmware requests to it. Requests which are not served
+ * within this many ms are cancelled.
+ */
+#define FIRMWARED_DEADLINE	30000
+
+int firmwared(int argc, char *argv[], char *envp[]);
+
+#endif
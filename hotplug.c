@@ -24,9 +24,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "bdpoll.h"
+#include "firmwarebench.h"
+#include "firmwared.h"
+#include "hotplug.h"
 #include "hotplug_basename.h"
+#include "hotplug_log.h"
+#include "hotplug_prefetch.h"
 #include "hotplug_socket.h"
+#include "hotplug_stats.h"
+#include "hotplug_uevent.h"
 #include "hotplug_util.h"
+#include "hotplugbroker.h"
+#include "hotplugring.h"
 #include "module_block.h"
 #include "module_firmware.h"
 #include "module_ieee1394.h"
@@ -34,6 +43,7 @@
 #include "module_scsi.h"
 #include "module_usb.h"
 #include "udev.h"
+#include "ueventreplay.h"
 
 struct command {
 	const char *name;
@@ -70,9 +80,64 @@ static struct subsys subsystems[] = {
 };
 
 #if defined(USE_LOG)
+volatile sig_atomic_t hotplug_log_level = HOTPLUG_LOG_FLOOR;
+
+static int log_level_parse(const char *value)
+{
+	int level = log_priority(value);
+
+	if (level < LOG_ERR)
+		level = LOG_ERR;
+	if (level > HOTPLUG_LOG_FLOOR)
+		level = HOTPLUG_LOG_FLOOR;
+	return level;
+}
+
+void log_level_init(void)
+{
+	char line[64];
+	const char *value;
+	FILE *f;
+
+	value = getenv("HOTPLUG_LOG_LEVEL");
+	if (value != NULL) {
+		hotplug_log_level = log_level_parse(value);
+		return;
+	}
+
+	f = fopen(HOTPLUG_LOG_CONF, "r");
+	if (f == NULL)
+		return;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "log_level=", 10) != 0)
+			continue;
+		remove_trailing_chars(line, '\n');
+		hotplug_log_level = log_level_parse(&line[10]);
+	}
+	fclose(f);
+}
+
+/* only the levels of err, info and dbg make a difference */
+void log_level_cycle(int signum)
+{
+	if (hotplug_log_level >= HOTPLUG_LOG_FLOOR)
+		hotplug_log_level = LOG_ERR;
+	else if (hotplug_log_level < LOG_INFO)
+		hotplug_log_level = LOG_INFO;
+	else
+		hotplug_log_level = LOG_DEBUG;
+}
+
 void log_message(int level, const char *format, ...)
 {
 	va_list args;
+	int ret;
+
+	va_start(args, format);
+	ret = hotplug_log_ring(level, format, args);
+	va_end(args);
+	if (ret == 0)
+		return;
 
 	va_start(args, format);
 	vsyslog(level, format, args);
@@ -98,31 +163,30 @@ static void redirect_io(void)
 #endif
 }
 
-static int hotplug(int argc, char *argv[], char *envp[])
+/*
+ * Handle the event ev for subsystem sysname. It must also be the
+ * environment: the handlers add their own variables to it and forward
+ * it to hotplug.socket, bdpoll and modprobe, so they still use getenv.
+ */
+int hotplug_dispatch(const char *sysname, const struct uevent *ev)
 {
 	const char *action;
 	const char *modalias;
 	struct subsys *s;
+	unsigned long long start;
 	unsigned int i;
-	const char *sysname;
-
-	redirect_io();
-
-	dbg("starting hotplug version %s", UDEV_VERSION);
-
-	if (argc < 2) {
-		err("hotplug expects a parameter, aborting.");
-		return EXIT_FAILURE;
-	}
-	sysname = argv[1];
+	int ret = EXIT_FAILURE;
 
-	action = getenv("ACTION");
+	action = ev->known[UEVENT_ACTION];
 	if (action == NULL) {
 		err("missing ACTION environment variable, aborting.");
 		return EXIT_FAILURE;
 	}
 
-	modalias = getenv("MODALIAS");
+	if (!hotplug_dry_run)
+		hotplug_stats_begin(sysname, action);
+
+	modalias = ev->known[UEVENT_MODALIAS];
 	if (modalias != NULL) {
 		if (!strcmp(ADD_STRING, action))
 			modprobe(modalias, true);
@@ -134,17 +198,38 @@ static int hotplug(int argc, char *argv[], char *envp[])
 		s = &subsystems[i];
 		if (strcmp(s->name, sysname))
 			continue;
+		start = hotplug_stats_now();
 		if (!strcmp(ADD_STRING, action) && s->add) {
-			return s->add();
+			ret = s->add();
 		} else if (!strcmp(REMOVE_STRING, action) && s->remove) {
-			return s->remove();
+			ret = s->remove();
 		} else {
 			dbg("we do not handle %s for %s", action, sysname);
-			return EXIT_SUCCESS;
+			ret = EXIT_SUCCESS;
 		}
+		hotplug_stats_add(HOTPLUG_STAGE_DISPATCH, start);
+		break;
+	}
+
+	hotplug_stats_end();
+	return ret;
+}
+
+static int hotplug(int argc, char *argv[], char *envp[])
+{
+	struct uevent ev;
+
+	redirect_io();
+
+	dbg("starting hotplug version %s", UDEV_VERSION);
+
+	if (argc < 2) {
+		err("hotplug expects a parameter, aborting.");
+		return EXIT_FAILURE;
 	}
 
-	return EXIT_FAILURE;
+	uevent_parse_env(&ev, envp);
+	return hotplug_dispatch(argv[1], &ev);
 }
 
 static const struct command cmds[] = {
@@ -168,6 +253,57 @@ static const struct command cmds[] = {
 		.cmd = udevtrigger,
 	},
 #endif
+#if defined(FIRMWAREBENCH)
+	{
+		.name = "firmwarebench",
+		.cmd = firmwarebench,
+	},
+#endif
+#if defined(FIRMWARED)
+	{
+		.name = "firmwared",
+		.cmd = firmwared,
+	},
+#endif
+#if defined(HOTPLUGBROKER)
+	{
+		.name = "hotplugbroker",
+		.cmd = hotplugbroker,
+	},
+#endif
+#if defined(HOTPLUG_LOG_RING)
+	{
+		.name = "hotpluglog",
+		.cmd = hotpluglog,
+	},
+#endif
+#if defined(HOTPLUG_PREFETCH)
+	{
+		.name = "hotplugprefetch",
+		.cmd = hotplugprefetch,
+	},
+#endif
+#if defined(HOTPLUG_RING)
+	{
+		.name = "hotplugring",
+		.cmd = hotplugring,
+	},
+#endif
+#if defined(HOTPLUG_STATS)
+	{
+		.name = "hotplugstats",
+		.cmd = hotplugstats,
+	},
+#endif
+#if defined(UEVENTREPLAY)
+	{
+		.name = "ueventreplay",
+		.cmd = ueventreplay,
+	},
+#endif
+	{
+		.name = NULL,
+	},
 };
 
 int main(int argc, char *argv[], char *envp[])
@@ -180,6 +316,7 @@ int main(int argc, char *argv[], char *envp[])
 	command = hotplug_basename(argv[0]);
 
 	logging_init(command);
+	hotplug_log_ring_init(command);
 
 	for (cmd = cmds; cmd->name != NULL; cmd++) {
 		if (strcmp(cmd->name, command) == 0) {
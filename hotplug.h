@@ -0,0 +1,8 @@
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+struct uevent;
+
+int hotplug_dispatch(const char *sysname, const struct uevent *ev);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+    hotplug_firmware_cache.c
+
+    Keeps firmware in HOTPLUG_FIRMWARE_CACHE_DIR, so that devices which
+    request it again after a reset do not wait for the flash.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "hotplug_firmware_cache.h"
+#include "module_firmware.h"
+#include "udev.h"
+
+#define CACHE_TMP	".tmp"
+
+static bool cache_name(char *buf, size_t size, const char *name, const struct stat *st)
+{
+	char *pos;
+
+	if ((size_t)snprintf(buf, size, "%s@%llu-%lld.%09ld", name, (unsigned long long)st->st_size,
+		 (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec) >= size)
+		return false;
+	for (pos = buf; *pos != '\0'; pos++)
+		if (*pos == '/')
+			*pos = '!';
+	return true;
+}
+
+/* only a directory of root's which no one else can write to is trusted */
+static int cache_dir_open(bool create)
+{
+	struct stat st;
+	int dir_fd;
+
+	if (create)
+		mkdir(HOTPLUG_FIRMWARE_CACHE_DIR, 0755);
+	dir_fd = open(HOTPLUG_FIRMWARE_CACHE_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd == -1)
+		return -1;
+	if (fstat(dir_fd, &st) == -1 || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		err("ignoring %s, not owned by root or writable by others", HOTPLUG_FIRMWARE_CACHE_DIR);
+		close(dir_fd);
+		return -1;
+	}
+	return dir_fd;
+}
+
+int hotplug_firmware_cache_open(const char *name, const struct stat *st)
+{
+	char entry[NAME_SIZE];
+	int dir_fd;
+	int fd;
+
+	if (!cache_name(entry, sizeof(entry), name, st))
+		return -1;
+
+	dir_fd = cache_dir_open(false);
+	if (dir_fd == -1)
+		return -1;
+	fd = openat(dir_fd, entry, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	close(dir_fd);
+	if (fd == -1)
+		return -1;
+
+	/* the modification time orders the entries for eviction */
+	futimens(fd, NULL);
+	dbg("firmware '%s' from the cache", name);
+	return fd;
+}
+
+/*
+ * Removes older versions of the entry and the least recently used entries
+ * until size more bytes fit.
+ */
+static bool cache_evict(int dir_fd, const char *entry, off_t size)
+{
+	const char *at = strrchr(entry, '@');
+	size_t prefix = at - entry + 1;
+	char oldest[NAME_SIZE];
+	struct timespec oldest_time = { 0, 0 };
+	unsigned long long total;
+	struct dirent *dent;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if (size > HOTPLUG_FIRMWARE_CACHE_MAX)
+		return false;
+
+	for (;;) {
+		fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+		dir = (fd == -1) ? NULL : fdopendir(fd);
+		if (dir == NULL) {
+			if (fd != -1)
+				close(fd);
+			return false;
+		}
+		rewinddir(dir);
+
+		total = 0;
+		oldest[0] = '\0';
+		while ((dent = readdir(dir)) != NULL) {
+			if (dent->d_name[0] == '.' ||
+			    fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+			    !S_ISREG(st.st_mode))
+				continue;
+			if (strncmp(dent->d_name, entry, prefix) == 0) {
+				unlinkat(dir_fd, dent->d_name, 0);
+				continue;
+			}
+			total += st.st_size;
+			if (oldest[0] == '\0' || st.st_mtim.tv_sec < oldest_time.tv_sec ||
+			    (st.st_mtim.tv_sec == oldest_time.tv_sec && st.st_mtim.tv_nsec < oldest_time.tv_nsec)) {
+				strlcpy(oldest, dent->d_name, sizeof(oldest));
+				oldest_time = st.st_mtim;
+			}
+		}
+		closedir(dir);
+
+		if (total + size <= HOTPLUG_FIRMWARE_CACHE_MAX)
+			return true;
+		dbg("evicting '%s'", oldest);
+		if (oldest[0] == '\0' || unlinkat(dir_fd, oldest, 0) == -1)
+			return false;
+	}
+}
+
+void hotplug_firmware_cache_add(const char *name, int src_fd, const struct stat *st,
+				enum firmware_format format)
+{
+	enum firmware_upload method = FIRMWARE_UPLOAD_SENDFILE;
+	char entry[NAME_SIZE];
+	struct stat tmp_st;
+	int dir_fd;
+	int fd;
+	int ret;
+
+	if (!cache_name(entry, sizeof(entry), name, st))
+		return;
+
+	dir_fd = cache_dir_open(true);
+	if (dir_fd == -1)
+		return;
+	if (flock(dir_fd, LOCK_EX) == -1)
+		goto out;
+
+	/* compressed firmware is stored decompressed, the copy stops at the same limit */
+	if (format == FIRMWARE_PLAIN && st->st_size > HOTPLUG_FIRMWARE_CACHE_MAX)
+		goto out;
+
+	fd = openat(dir_fd, CACHE_TMP, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto out;
+	/* the firmware has just been read, this copy comes from the page cache */
+	if (format != FIRMWARE_PLAIN)
+		ret = firmware_decompress(fd, src_fd, 0, format, HOTPLUG_FIRMWARE_CACHE_MAX);
+	else
+		ret = firmware_upload(fd, src_fd, st->st_size, 0, &method);
+	if (ret != -1)
+		ret = fstat(fd, &tmp_st);
+	close(fd);
+
+	if (ret == -1) {
+		if (errno == EFBIG)
+			dbg("firmware '%s' too large to cache", name);
+		else
+			err("can't cache firmware '%s': %s", name, strerror(errno));
+		unlinkat(dir_fd, CACHE_TMP, 0);
+		goto out;
+	}
+	if (!cache_evict(dir_fd, entry, tmp_st.st_size)) {
+		unlinkat(dir_fd, CACHE_TMP, 0);
+		goto out;
+	}
+	if (renameat(dir_fd, CACHE_TMP, dir_fd, entry) == -1) {
+		err("can't cache firmware '%s': %s", name, strerror(errno));
+		unlinkat(dir_fd, CACHE_TMP, 0);
+	}
+out:
+	close(dir_fd);
+}
@@ -0,0 +1,30 @@
+#ifndef HOTPLUG_FIRMWARE_CACHE_H
+#define HOTPLUG_FIRMWARE_CACHE_H
+
+#include <sys/stat.h>
+#include "module_firmware.h"
+
+/*
+ * Copies of uploaded firmware on tmpfs, named "<name>@<size>-<mtime>" with
+ * '/' in name replaced by '!'. The directory must belong to root and be
+ * writable by no one else. A changed file in the search path gets a
+ * new entry. The least recently used entries are removed to stay below
+ * HOTPLUG_FIRMWARE_CACHE_MAX bytes.
+ */
+#define HOTPLUG_FIRMWARE_CACHE_DIR	"/var/run/hotplug.firmware"
+#ifndef HOTPLUG_FIRMWARE_CACHE_MAX
+#define HOTPLUG_FIRMWARE_CACHE_MAX	(4 * 1024 * 1024)
+#endif
+
+#if defined(HOTPLUG_FIRMWARE_CACHE)
+/* st describes the file found in the search path, entries are decompressed */
+int hotplug_firmware_cache_open(const char *name, const struct stat *st);
+void hotplug_firmware_cache_add(const char *name, int src_fd, const struct stat *st,
+				enum firmware_format format);
+#else
+static inline int hotplug_firmware_cache_open(const char *name, const struct stat *st) { return -1; }
+static inline void hotplug_firmware_cache_add(const char *name, int src_fd, const struct stat *st,
+					      enum firmware_format format) {}
+#endif
+
+#endif
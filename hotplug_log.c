@@ -0,0 +1,198 @@
+/*
+    hotplug_log.c
+
+    Logs into a shared memory ring, which costs no more than formatting
+    the message, and dumps or forwards the ring to syslog on demand.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "hotplug_log.h"
+#include "hotplug_ring.h"
+#include "udev.h"
+
+#define LOG_LINE_SIZE	1024
+
+static const char *log_name = "hotplug";
+static struct hotplug_ring log_ring;
+static bool log_ring_failed;
+static volatile int log_exit;
+
+static const char *priority_name[] = {
+	[LOG_EMERG] = "emerg",
+	[LOG_ALERT] = "alert",
+	[LOG_CRIT] = "crit",
+	[LOG_ERR] = "err",
+	[LOG_WARNING] = "warning",
+	[LOG_NOTICE] = "notice",
+	[LOG_INFO] = "info",
+	[LOG_DEBUG] = "debug",
+};
+
+void hotplug_log_ring_init(const char *program_name)
+{
+	log_name = program_name;
+}
+
+int hotplug_log_ring(int priority, const char *format, va_list args)
+{
+	char line[LOG_LINE_SIZE];
+	int len;
+
+	/* the first process creates the ring, syslog is left if it fails */
+	if (log_ring.hdr == NULL) {
+		if (log_ring_failed ||
+		    hotplug_ring_open(&log_ring, HOTPLUG_LOG_RING_FILE, HOTPLUG_LOG_RING_SIZE) == -1) {
+			log_ring_failed = true;
+			return -1;
+		}
+	}
+
+	len = snprintf(line, sizeof(line), "<%d>%s[%d]: ", LOG_PRI(priority), log_name, getpid());
+	if (len < (int)sizeof(line))
+		len += vsnprintf(&line[len], sizeof(line) - len, format, args);
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+
+	return hotplug_ring_append(&log_ring, line, len + 1);
+}
+
+static void asmlinkage sig_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		log_exit = 1;
+}
+
+/* the message is copied before it is checked, the ring may move on meanwhile */
+static void log_print(const struct hotplug_ring *ring, const struct hotplug_ring_record *rec, int forward)
+{
+	char line[LOG_LINE_SIZE];
+	size_t len = rec->len;
+	unsigned long long usec = rec->usec;
+	int priority = LOG_INFO;
+	char *msg = line;
+	char *end;
+
+	if (len > sizeof(line))
+		len = sizeof(line);
+	memcpy(line, rec->data, len);
+	if (!hotplug_ring_valid(ring, rec))
+		return;
+	line[len - 1] = '\0';
+
+	if (line[0] == '<') {
+		priority = strtol(&line[1], &end, 10);
+		if (*end == '>' && priority >= LOG_EMERG && priority <= LOG_DEBUG)
+			msg = &end[1];
+		else
+			priority = LOG_INFO;
+	}
+
+	if (forward)
+		syslog(priority, "%s", msg);
+	else
+		printf("[%5llu.%06llu] %-7s %s\n", usec / 1000000, usec % 1000000,
+		       priority_name[priority], msg);
+}
+
+int hotpluglog(int argc, char *argv[], char *envp[])
+{
+	const struct hotplug_ring_record *rec;
+	struct hotplug_ring ring;
+	struct sigaction act;
+	unsigned long lost = 0, reported = 0;
+	int follow = 0;
+	int forward = 0;
+	int option;
+
+	static const struct option options[] = {
+		{ "follow", 0, NULL, 'f' },
+		{ "syslog", 0, NULL, 's' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "fsh", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 'f':
+			follow = 1;
+			break;
+		case 's':
+			forward = 1;
+			follow = 1;
+			break;
+		case 'h':
+			printf("Usage: hotpluglog [--follow] [--syslog] [--help]\n"
+			       "  without options, print the messages in " HOTPLUG_LOG_RING_FILE "\n"
+			       "  --follow    then wait for new ones\n"
+			       "  --syslog    forward new messages to syslog, in the background\n"
+			       "  --help\n\n");
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	if (hotplug_ring_open(&ring, HOTPLUG_LOG_RING_FILE, forward ? HOTPLUG_LOG_RING_SIZE : 0) == -1) {
+		fprintf(stderr, HOTPLUG_LOG_RING_FILE ": %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (forward) {
+		if (daemon(0, 0) == -1) {
+			hotplug_ring_close(&ring);
+			return 1;
+		}
+		openlog(NULL, 0, LOG_DAEMON);
+	} else {
+		hotplug_ring_rewind(&ring);
+	}
+
+	memset(&act, 0x00, sizeof(struct sigaction));
+	act.sa_handler = (void (*)(int)) sig_handler;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	while (!log_exit) {
+		rec = hotplug_ring_next(&ring, &lost);
+		if (lost != reported) {
+			if (forward)
+				syslog(LOG_WARNING, "hotpluglog: messages lost");
+			else
+				printf("(messages lost)\n");
+			reported = lost;
+		}
+		if (rec != NULL)
+			log_print(&ring, rec, forward);
+		else if (!follow)
+			break;
+		else if (fflush(stdout) == EOF || hotplug_ring_wait(&ring, -1) == -1)
+			break;
+	}
+
+	hotplug_ring_close(&ring);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef HOTPLUG_LOG_H
+#define HOTPLUG_LOG_H
+
+#include <stdarg.h>
+
+/*
+ * With USE_LOG, messages go to this ring instead of syslog, as
+ * "<priority>program[pid]: message". hotpluglog dumps it or forwards it
+ * to syslog.
+ */
+#define HOTPLUG_LOG_RING_FILE	"/dev/shm/hotplug.log"
+#ifndef HOTPLUG_LOG_RING_SIZE
+#define HOTPLUG_LOG_RING_SIZE	(64 * 1024)
+#endif
+
+#if defined(HOTPLUG_LOG_RING)
+void hotplug_log_ring_init(const char *program_name);
+int hotplug_log_ring(int priority, const char *format, va_list args);
+
+int hotpluglog(int argc, char *argv[], char *envp[]);
+#else
+static inline void hotplug_log_ring_init(const char *program_name) {}
+static inline int hotplug_log_ring(int priority, const char *format, va_list args) { return -1; }
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+/*
+    hotplug_netlink.c
+
+    Kernel uevent netlink socket shared by all uevent consumers.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <linux/types.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include "hotplug_netlink.h"
+#include "udev.h"
+
+int hotplug_netlink_open(int rcvbuf, struct hotplug_netlink_stats *stats)
+{
+	struct sockaddr_nl snl;
+	socklen_t optlen;
+	int sock;
+
+	memset(stats, 0x00, sizeof(struct hotplug_netlink_stats));
+
+	memset(&snl, 0x00, sizeof(struct sockaddr_nl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_pid = getpid();
+	snl.nl_groups = 1;
+
+	sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (sock == -1) {
+		fprintf(stderr, "error getting socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* the force variant ignores rmem_max, but needs CAP_NET_ADMIN */
+	if (rcvbuf > 0 &&
+	    setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1 &&
+	    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1)
+		fprintf(stderr, "error setting receive buffer: %s\n", strerror(errno));
+
+	optlen = sizeof(stats->rcvbuf);
+	getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf, &optlen);
+
+	if (bind(sock, (struct sockaddr *) &snl, sizeof(struct sockaddr_nl)) < 0) {
+		fprintf(stderr, "bind failed: %s\n", strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* count a received event, seqnum is the value of its SEQNUM key */
+void hotplug_netlink_account(struct hotplug_netlink_stats *stats, const char *seqnum)
+{
+	unsigned long long value;
+
+	stats->received++;
+	if (seqnum == NULL)
+		return;
+
+	value = strtoull(seqnum, NULL, 10);
+	if (!stats->filtered && stats->last_seqnum != 0 && value > stats->last_seqnum + 1) {
+		stats->seqnum_gaps++;
+		stats->seqnum_lost += value - stats->last_seqnum - 1;
+	}
+	if (value > stats->last_seqnum)
+		stats->last_seqnum = value;
+}
+
+void hotplug_netlink_enobufs(struct hotplug_netlink_stats *stats)
+{
+	stats->enobufs++;
+}
+
+void hotplug_netlink_print_stats(const struct hotplug_netlink_stats *stats)
+{
+	fprintf(stderr, "uevent netlink: received %llu, receive buffer %i bytes, "
+		"overflows %llu, seqnum gaps %llu (%llu events lost), last seqnum %llu\n",
+		stats->received, stats->rcvbuf, stats->enobufs,
+		stats->seqnum_gaps, stats->seqnum_lost, stats->last_seqnum);
+}
+
+void hotplug_netlink_filter_init(struct hotplug_netlink_filter *filter)
+{
+	INIT_LIST_HEAD(&filter->subsystem_list);
+	INIT_LIST_HEAD(&filter->action_list);
+	INIT_LIST_HEAD(&filter->devpath_list);
+}
+
+void hotplug_netlink_filter_cleanup(struct hotplug_netlink_filter *filter)
+{
+	name_list_cleanup(&filter->subsystem_list);
+	name_list_cleanup(&filter->action_list);
+	name_list_cleanup(&filter->devpath_list);
+}
+
+/*
+ * Socket filter program, built from forward jumps to labels which are
+ * resolved when the program is complete. Only unconditional jumps can
+ * reach further than 255 instructions, so every comparison falls into
+ * a "ja" on mismatch.
+ */
+struct bpf_builder {
+	struct sock_filter insns[BPF_MAXINSNS];
+	int labels[BPF_MAXINSNS];
+	unsigned int len;
+	unsigned int label_count;
+};
+
+/* "<action>@<devpath>" headers longer than this pass the subsystem check */
+#define BPF_HEADER_MAX		512
+/* bytes of the header probed for its end after one length check */
+#define BPF_HEADER_STEP		32
+
+static void bpf_emit(struct bpf_builder *b, unsigned short code,
+		     unsigned char jt, unsigned char jf, unsigned int k)
+{
+	if (b->len < BPF_MAXINSNS) {
+		b->insns[b->len].code = code;
+		b->insns[b->len].jt = jt;
+		b->insns[b->len].jf = jf;
+		b->insns[b->len].k = k;
+	}
+	b->len++;
+}
+
+static int bpf_label(struct bpf_builder *b)
+{
+	if (b->label_count == BPF_MAXINSNS)
+		return 0;
+	b->labels[b->label_count] = -1;
+	return b->label_count++;
+}
+
+static void bpf_place(struct bpf_builder *b, int label)
+{
+	b->labels[label] = b->len;
+}
+
+static void bpf_jump(struct bpf_builder *b, int label)
+{
+	bpf_emit(b, BPF_JMP | BPF_JA, 0, 0, label);
+}
+
+/*
+ * Continue if the packet has at least k bytes from x on, jump to label
+ * otherwise. A load beyond the end would drop the packet instead.
+ */
+static void bpf_expect_len(struct bpf_builder *b, unsigned int k, int label)
+{
+	bpf_emit(b, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+	bpf_emit(b, BPF_JMP | BPF_JGE | BPF_X, 0, 2, 0);
+	bpf_emit(b, BPF_ALU | BPF_SUB | BPF_X, 0, 0, 0);
+	bpf_emit(b, BPF_JMP | BPF_JGE | BPF_K, 1, 0, k);
+	bpf_jump(b, label);
+}
+
+/* continue if the byte at [k] or [x + k] is c, jump to label otherwise */
+static void bpf_expect(struct bpf_builder *b, int indexed, unsigned int k, unsigned char c, int label)
+{
+	bpf_emit(b, BPF_LD | BPF_B | (indexed ? BPF_IND : BPF_ABS), 0, 0, k);
+	bpf_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, c);
+	bpf_jump(b, label);
+}
+
+/*
+ * Continue if one of the strings is found at [x + k], followed by the
+ * terminator unless it is -1, reject otherwise. Packets too short for
+ * the longest string are accepted.
+ */
+static void bpf_expect_one_of(struct bpf_builder *b, struct list_head *list,
+			      unsigned int k, int terminator, int accept, int reject)
+{
+	struct name_entry *entry;
+	size_t max = 0;
+	int match;
+	int next;
+	size_t i;
+
+	list_for_each_entry(entry, list, node)
+		if (strlen(entry->name) > max)
+			max = strlen(entry->name);
+	bpf_expect_len(b, k + max + (terminator != -1), accept);
+
+	match = bpf_label(b);
+	list_for_each_entry(entry, list, node) {
+		next = bpf_label(b);
+		for (i = 0; entry->name[i] != '\0'; i++)
+			bpf_expect(b, 1, k + i, entry->name[i], next);
+		if (terminator != -1)
+			bpf_expect(b, 1, k + i, terminator, next);
+		bpf_jump(b, match);
+		bpf_place(b, next);
+	}
+	bpf_jump(b, reject);
+	bpf_place(b, match);
+}
+
+/*
+ * Kernel events start with "<action>@<devpath>\0", followed by the
+ * ACTION, DEVPATH and SUBSYSTEM keys in this order, so the SUBSYSTEM
+ * key of a header of length h starts at 2 * h + 17. Events which do
+ * not look like this, or end before a probed position, are passed on
+ * and left to the caller.
+ */
+int hotplug_netlink_filter_attach(int sock, struct hotplug_netlink_filter *filter,
+				  struct hotplug_netlink_stats *stats)
+{
+	static struct bpf_builder b;
+	static const char subsystem_key[] = "SUBSYSTEM=";
+	struct sock_fprog fprog;
+	int accept, reject, at, nul;
+	unsigned int i;
+
+	if (list_empty(&filter->subsystem_list) &&
+	    list_empty(&filter->action_list) &&
+	    list_empty(&filter->devpath_list))
+		return 0;
+
+	memset(&b, 0x00, sizeof(b));
+	accept = bpf_label(&b);
+	reject = bpf_label(&b);
+	at = bpf_label(&b);
+	nul = bpf_label(&b);
+
+	/* M[0] = X = position of the '@' */
+	bpf_emit(&b, BPF_LDX | BPF_IMM, 0, 0, 0);
+	bpf_expect_len(&b, 16, accept);
+	for (i = 1; i < 16; i++) {
+		bpf_emit(&b, BPF_LD | BPF_B | BPF_ABS, 0, 0, i);
+		bpf_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 2, '@');
+		bpf_emit(&b, BPF_LDX | BPF_IMM, 0, 0, i);
+		bpf_jump(&b, at);
+	}
+	bpf_jump(&b, accept);
+	bpf_place(&b, at);
+	bpf_emit(&b, BPF_STX, 0, 0, 0);
+
+	/* the action is followed by the '@', the devpath prefix follows it */
+	if (!list_empty(&filter->action_list)) {
+		bpf_emit(&b, BPF_LDX | BPF_IMM, 0, 0, 0);
+		bpf_expect_one_of(&b, &filter->action_list, 0, '@', accept, reject);
+		bpf_emit(&b, BPF_LDX | BPF_MEM, 0, 0, 0);
+	}
+	if (!list_empty(&filter->devpath_list))
+		bpf_expect_one_of(&b, &filter->devpath_list, 1, -1, accept, reject);
+
+	if (!list_empty(&filter->subsystem_list)) {
+		/* length of the header */
+		for (i = 1; i < BPF_HEADER_MAX; i++) {
+			/* an event is longer than twice its header, this only cuts off others */
+			if ((i - 1) % BPF_HEADER_STEP == 0)
+				bpf_expect_len(&b, (i + BPF_HEADER_STEP < BPF_HEADER_MAX) ?
+					       i + BPF_HEADER_STEP : BPF_HEADER_MAX, accept);
+			bpf_emit(&b, BPF_LD | BPF_B | BPF_IND, 0, 0, i);
+			bpf_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0);
+			bpf_emit(&b, BPF_LD | BPF_IMM, 0, 0, i);
+			bpf_jump(&b, nul);
+		}
+		bpf_jump(&b, accept);
+		bpf_place(&b, nul);
+
+		/* X = 2 * (M[0] + A) + 17 */
+		bpf_emit(&b, BPF_LDX | BPF_MEM, 0, 0, 0);
+		bpf_emit(&b, BPF_ALU | BPF_ADD | BPF_X, 0, 0, 0);
+		bpf_emit(&b, BPF_ALU | BPF_MUL | BPF_K, 0, 0, 2);
+		bpf_emit(&b, BPF_ALU | BPF_ADD | BPF_K, 0, 0, 17);
+		bpf_emit(&b, BPF_MISC | BPF_TAX, 0, 0, 0);
+		bpf_expect_len(&b, strlen(subsystem_key), accept);
+		for (i = 0; subsystem_key[i] != '\0'; i++)
+			bpf_expect(&b, 1, i, subsystem_key[i], accept);
+		bpf_expect_one_of(&b, &filter->subsystem_list, i, '\0', accept, reject);
+	}
+
+	bpf_place(&b, accept);
+	bpf_emit(&b, BPF_RET | BPF_K, 0, 0, 0xffffffff);
+	bpf_place(&b, reject);
+	bpf_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+
+	if (b.len > BPF_MAXINSNS) {
+		fprintf(stderr, "filter too large, filtering in user space\n");
+		return -1;
+	}
+	for (i = 0; i < b.len; i++)
+		if (b.insns[i].code == (BPF_JMP | BPF_JA))
+			b.insns[i].k = b.labels[b.insns[i].k] - (i + 1);
+
+	fprog.len = b.len;
+	fprog.filter = b.insns;
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1) {
+		fprintf(stderr, "error attaching socket filter: %s\n", strerror(errno));
+		return -1;
+	}
+
+	stats->filtered = 1;
+	return 0;
+}
+
+static int name_list_match(struct list_head *list, const char *str, int prefix)
+{
+	struct name_entry *entry;
+
+	if (list_empty(list))
+		return 1;
+	if (str == NULL)
+		return 0;
+
+	list_for_each_entry(entry, list, node) {
+		if (prefix && strncmp(str, entry->name, strlen(entry->name)) == 0)
+			return 1;
+		if (!prefix && strcmp(str, entry->name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* the same filter for events which passed the kernel or come from elsewhere */
+int hotplug_netlink_filter_match(struct hotplug_netlink_filter *filter,
+				 const char *action, const char *devpath, const char *subsystem)
+{
+	return name_list_match(&filter->action_list, action, 0) &&
+	       name_list_match(&filter->devpath_list, devpath, 1) &&
+	       name_list_match(&filter->subsystem_list, subsystem, 0);
+}
@@ -0,0 +1,39 @@
+#ifndef HOTPLUG_NETLINK_H
+#define HOTPLUG_NETLINK_H
+
+#include <stddef.h>
+#include "list.h"
+
+/* default receive buffer for kernel uevents, large enough for coldplug */
+#define HOTPLUG_NETLINK_RCVBUF	(1024 * 1024)
+
+struct hotplug_netlink_stats {
+	unsigned long long received;
+	unsigned long long enobufs;		/* receive buffer overflows */
+	unsigned long long seqnum_gaps;		/* holes in the SEQNUM sequence */
+	unsigned long long seqnum_lost;		/* events missing in these holes */
+	unsigned long long last_seqnum;
+	int rcvbuf;				/* effective receive buffer size */
+	int filtered;				/* events are dropped in the kernel */
+};
+
+/* events pass if they match one entry of every non-empty list */
+struct hotplug_netlink_filter {
+	struct list_head subsystem_list;
+	struct list_head action_list;
+	struct list_head devpath_list;		/* devpath prefixes */
+};
+
+int hotplug_netlink_open(int rcvbuf, struct hotplug_netlink_stats *stats);
+void hotplug_netlink_account(struct hotplug_netlink_stats *stats, const char *seqnum);
+void hotplug_netlink_enobufs(struct hotplug_netlink_stats *stats);
+void hotplug_netlink_print_stats(const struct hotplug_netlink_stats *stats);
+
+void hotplug_netlink_filter_init(struct hotplug_netlink_filter *filter);
+void hotplug_netlink_filter_cleanup(struct hotplug_netlink_filter *filter);
+int hotplug_netlink_filter_attach(int sock, struct hotplug_netlink_filter *filter,
+				  struct hotplug_netlink_stats *stats);
+int hotplug_netlink_filter_match(struct hotplug_netlink_filter *filter,
+				 const char *action, const char *devpath, const char *subsystem);
+
+#endif
@@ -17,8 +17,12 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/file.h>
 #include "hotplug_pidfile.h"
 #include "udev_sysdeps.h"
 
@@ -86,3 +90,56 @@ int pidfile_unlink(const char *fmt, ...)
 	return unlink(filename);
 }
 
+
+/*
+ * Writes the pid of the caller and keeps the file locked until it exits.
+ * Returns the fd holding the lock, -1 with EWOULDBLOCK if another process
+ * holds it.
+ */
+int pidfile_lock(const char *fmt, ...)
+{
+	char filename[FILENAME_MAX];
+	va_list ap;
+	int fd;
+
+	va_start(ap, fmt);
+	pidfile_set_name(filename, sizeof(filename), fmt, ap);
+	va_end(ap);
+
+	fd = open(filename, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		perror(filename);
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+		goto err;
+	if (ftruncate(fd, 0) == -1 || dprintf(fd, "%d\n", getpid()) < 0)
+		goto err;
+
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+/* unlike a pid, the lock of a process which exited can't be mistaken for another */
+int pidfile_locked(const char *fmt, ...)
+{
+	char filename[FILENAME_MAX];
+	va_list ap;
+	int ret = 0;
+	int fd;
+
+	va_start(ap, fmt);
+	pidfile_set_name(filename, sizeof(filename), fmt, ap);
+	va_end(ap);
+
+	fd = open(filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+	if (flock(fd, LOCK_SH | LOCK_NB) == -1 && errno == EWOULDBLOCK)
+		ret = 1;
+	close(fd);
+
+	return ret;
+}
@@ -6,5 +6,7 @@
 int pidfile_read(pid_t *pid, const char *fmt, ...);
 int pidfile_write(pid_t pid, const char *fmt, ...);
 int pidfile_unlink(const char *fmt, ...);
+int pidfile_lock(const char *fmt, ...);
+int pidfile_locked(const char *fmt, ...);
 
 #endif
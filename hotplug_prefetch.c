@@ -0,0 +1,364 @@
+/*
+    hotplug_prefetch.c
+
+    Records the modules and firmware loaded during a boot, and reads them
+    ahead early on the next one.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "hotplug_prefetch.h"
+#include "module_firmware.h"
+#include "udev.h"
+
+#define PREFETCH_JOBS	4
+
+/* the files modprobe reads before any module */
+static const char *module_indexes[] = {
+	"modules.dep", "modules.dep.bin", "modules.alias", "modules.alias.bin",
+	"modules.symbols", "modules.symbols.bin", "modules.builtin", "modules.builtin.bin",
+	"modules.softdep",
+};
+
+static int verbose;
+
+/*
+ * One short O_APPEND write, lines of concurrent helpers do not mix.
+ * Nothing is recorded unless the log exists, that is from the
+ * readahead early during boot until --save.
+ */
+void hotplug_prefetch_record(char type, const char *name)
+{
+	char line[NAME_SIZE + 3];
+	int len;
+	int fd;
+
+	len = snprintf(line, sizeof(line), "%c %s\n", type, name);
+	if (len >= (int)sizeof(line) || strchr(name, '\n') != NULL)
+		return;
+
+	fd = open(HOTPLUG_PREFETCH_LOG, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	if (write(fd, line, len) != len)
+		dbg("%s: %s", HOTPLUG_PREFETCH_LOG, strerror(errno));
+	close(fd);
+}
+
+/* "M name" and "F name" lines in their first order, without duplicates */
+static int profile_read(const char *filename, struct list_head *list)
+{
+	char line[NAME_SIZE + 3];
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		remove_trailing_chars(line, '\n');
+		if ((line[0] != HOTPLUG_PREFETCH_MODULE && line[0] != HOTPLUG_PREFETCH_FIRMWARE) ||
+		    line[1] != ' ' || line[2] == '\0')
+			continue;
+		name_list_add(list, line, 0);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int profile_save(void)
+{
+	struct name_entry *entry;
+	LIST_HEAD(list);
+	FILE *f;
+	int ret = 0;
+
+	if (profile_read(HOTPLUG_PREFETCH_LOG, &list) == -1) {
+		fprintf(stderr, HOTPLUG_PREFETCH_LOG ": %s\n", strerror(errno));
+		return 1;
+	}
+
+	f = fopen(HOTPLUG_PREFETCH_PROFILE ".tmp", "w");
+	if (f == NULL) {
+		fprintf(stderr, HOTPLUG_PREFETCH_PROFILE ".tmp: %s\n", strerror(errno));
+		name_list_cleanup(&list);
+		return 1;
+	}
+	list_for_each_entry(entry, &list, node)
+		fprintf(f, "%s\n", entry->name);
+
+	if (fclose(f) == EOF || rename(HOTPLUG_PREFETCH_PROFILE ".tmp", HOTPLUG_PREFETCH_PROFILE) == -1) {
+		fprintf(stderr, HOTPLUG_PREFETCH_PROFILE ": %s\n", strerror(errno));
+		unlink(HOTPLUG_PREFETCH_PROFILE ".tmp");
+		ret = 1;
+	} else {
+		/* the boot is over, stop recording */
+		unlink(HOTPLUG_PREFETCH_LOG);
+	}
+
+	name_list_cleanup(&list);
+	return ret;
+}
+
+static void readahead_fd(int fd, const char *name)
+{
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	if (verbose)
+		printf("%s\n", name);
+}
+
+static void readahead_file(int dir_fd, const char *name)
+{
+	int fd;
+
+	fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	readahead_fd(fd, name);
+	close(fd);
+}
+
+/* module names do not distinguish '-' and '_' */
+static void module_name(char *buf, size_t size, const char *path)
+{
+	const char *base = strrchr(path, '/');
+	char *pos;
+
+	strlcpy(buf, base ? &base[1] : path, size);
+	pos = strstr(buf, ".ko");
+	if (pos != NULL)
+		*pos = '\0';
+	for (pos = buf; *pos != '\0'; pos++)
+		if (*pos == '-')
+			*pos = '_';
+}
+
+/* modaliases to the names of the modules which serve them */
+static void modules_resolve(int dir_fd, struct list_head *wanted, struct list_head *modules)
+{
+	char line[PATH_SIZE];
+	char name[NAME_SIZE];
+	char *pattern, *target, *saveptr;
+	struct name_entry *entry;
+	bool aliases = false;
+	FILE *f;
+	int fd;
+
+	list_for_each_entry(entry, wanted, node) {
+		if (strchr(entry->name, ':') == NULL) {
+			module_name(name, sizeof(name), entry->name);
+			name_list_add(modules, name, 0);
+		} else {
+			aliases = true;
+		}
+	}
+	if (!aliases)
+		return;
+
+	fd = openat(dir_fd, "modules.alias", O_RDONLY | O_CLOEXEC);
+	f = (fd != -1) ? fdopen(fd, "r") : NULL;
+	if (f == NULL) {
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		/* "alias <pattern> <module>", both are used in place */
+		if (strncmp(line, "alias ", 6) != 0)
+			continue;
+		pattern = strtok_r(&line[6], " \t\n", &saveptr);
+		target = strtok_r(NULL, " \t\n", &saveptr);
+		if (pattern == NULL || target == NULL)
+			continue;
+		list_for_each_entry(entry, wanted, node) {
+			if (strchr(entry->name, ':') != NULL && fnmatch(pattern, entry->name, 0) == 0) {
+				module_name(name, sizeof(name), target);
+				name_list_add(modules, name, 0);
+			}
+		}
+	}
+	fclose(f);
+}
+
+/* the .ko files of the modules and of their dependencies */
+static void modules_readahead(int dir_fd, struct list_head *modules)
+{
+	char line[4096];
+	char name[NAME_SIZE];
+	struct name_entry *entry;
+	char *path, *saveptr;
+	FILE *f;
+	int fd;
+
+	fd = openat(dir_fd, "modules.dep", O_RDONLY | O_CLOEXEC);
+	f = (fd != -1) ? fdopen(fd, "r") : NULL;
+	if (f == NULL) {
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		path = strtok_r(line, ": \n", &saveptr);
+		if (path == NULL)
+			continue;
+		module_name(name, sizeof(name), path);
+		list_for_each_entry(entry, modules, node) {
+			if (strcmp(entry->name, name) != 0)
+				continue;
+			for (; path != NULL; path = strtok_r(NULL, " \n", &saveptr))
+				readahead_file(dir_fd, path);
+			break;
+		}
+	}
+	fclose(f);
+}
+
+/* modprobe up to PREFETCH_JOBS modules at once */
+static void modules_load(struct list_head *wanted)
+{
+	struct name_entry *entry;
+	unsigned int jobs = 0;
+	pid_t pid;
+
+	list_for_each_entry(entry, wanted, node) {
+		if (jobs == PREFETCH_JOBS && wait(NULL) > 0)
+			jobs--;
+		pid = fork();
+		if (pid == 0) {
+			execl("/sbin/modprobe", "/sbin/modprobe", "-q", entry->name, NULL);
+			_exit(1);
+		}
+		if (pid > 0)
+			jobs++;
+	}
+	while (jobs > 0 && wait(NULL) > 0)
+		jobs--;
+}
+
+static int profile_prefetch(int load)
+{
+	char path[PATH_SIZE];
+	struct name_entry *entry;
+	enum firmware_format format;
+	struct utsname uts;
+	struct stat st;
+	LIST_HEAD(profile);
+	LIST_HEAD(wanted);
+	LIST_HEAD(modules);
+	unsigned int i;
+	int dir_fd;
+	int fd;
+
+	/* record this boot, also the first one without a profile */
+	fd = open(HOTPLUG_PREFETCH_LOG, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd != -1)
+		close(fd);
+
+	if (profile_read(HOTPLUG_PREFETCH_PROFILE, &profile) == -1) {
+		fprintf(stderr, HOTPLUG_PREFETCH_PROFILE ": %s\n", strerror(errno));
+		return 1;
+	}
+
+	list_for_each_entry(entry, &profile, node) {
+		if (entry->name[0] == HOTPLUG_PREFETCH_MODULE) {
+			name_list_add(&wanted, &entry->name[2], 0);
+			continue;
+		}
+		fd = firmware_open(&entry->name[2], &st, &format);
+		if (fd == -1)
+			continue;
+		readahead_fd(fd, &entry->name[2]);
+		close(fd);
+	}
+
+	if (!list_empty(&wanted) && uname(&uts) == 0) {
+		snprintf(path, sizeof(path), "/lib/modules/%s", uts.release);
+		dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd != -1) {
+			for (i = 0; i < sizeof(module_indexes) / sizeof(module_indexes[0]); i++)
+				readahead_file(dir_fd, module_indexes[i]);
+			modules_resolve(dir_fd, &wanted, &modules);
+			modules_readahead(dir_fd, &modules);
+			close(dir_fd);
+		}
+		if (load)
+			modules_load(&wanted);
+	}
+
+	name_list_cleanup(&modules);
+	name_list_cleanup(&wanted);
+	name_list_cleanup(&profile);
+	return 0;
+}
+
+int hotplugprefetch(int argc, char *argv[], char *envp[])
+{
+	int save = 0;
+	int load = 0;
+	int option;
+
+	static const struct option options[] = {
+		{ "save", 0, NULL, 's' },
+		{ "modprobe", 0, NULL, 'm' },
+		{ "verbose", 0, NULL, 'v' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "smvh", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 's':
+			save = 1;
+			break;
+		case 'm':
+			load = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			printf("Usage: hotplugprefetch [--save] [--modprobe] [--verbose] [--help]\n"
+			       "  without --save, read the modules and firmware of "
+			       HOTPLUG_PREFETCH_PROFILE " ahead\n"
+			       "  --save      replace " HOTPLUG_PREFETCH_PROFILE " by what this boot loaded\n"
+			       "  --modprobe  also load the modules, %u at once\n"
+			       "  --verbose   print the files read ahead\n"
+			       "  --help\n\n", PREFETCH_JOBS);
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	if (save)
+		return profile_save();
+	return profile_prefetch(load);
+}
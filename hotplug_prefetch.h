@@ -0,0 +1,24 @@
+#ifndef HOTPLUG_PREFETCH_H
+#define HOTPLUG_PREFETCH_H
+
+/*
+ * Modules and firmware loaded during this boot, one "M <module or
+ * modalias>" or "F <firmware>" line each. hotplugprefetch creates the log
+ * early during boot, --save keeps it in the profile and removes it, so
+ * later loads are not recorded.
+ */
+#define HOTPLUG_PREFETCH_LOG		"/var/run/hotplug.prefetch"
+#define HOTPLUG_PREFETCH_PROFILE	"/etc/hotplug.prefetch"
+
+#define HOTPLUG_PREFETCH_MODULE		'M'
+#define HOTPLUG_PREFETCH_FIRMWARE	'F'
+
+#if defined(HOTPLUG_PREFETCH)
+void hotplug_prefetch_record(char type, const char *name);
+
+int hotplugprefetch(int argc, char *argv[], char *envp[]);
+#else
+static inline void hotplug_prefetch_record(char type, const char *name) {}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+/*
+    hotplug_proctab.c
+
+    Keeps the helper processes per device in a shared table, and signals
+    them through pidfds where the kernel has them.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "hotplug_proctab.h"
+#include "udev.h"
+
+#define HOTPLUG_PROCTAB_VERSION	1
+
+struct proctab_entry {
+	pid_t pid;				/* 0 if the slot is free */
+	unsigned long long starttime;
+	char devpath[PATH_SIZE];
+};
+
+struct proctab {
+	char magic[4];
+	unsigned int version;
+	struct proctab_entry entries[HOTPLUG_PROCTAB_SLOTS];
+};
+
+/* field 3 and 22 of /proc/<pid>/stat */
+static int proc_stat(pid_t pid, char *state, unsigned long long *starttime)
+{
+	char filename[64];
+	char buf[512];
+	const char *p;
+	ssize_t len;
+	int fd;
+
+	snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	/* the command name may contain anything, up to the last parenthesis */
+	p = strrchr(buf, ')');
+	if (p == NULL || sscanf(p + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+				" %*d %*d %*d %*d %*d %*d %llu", state, starttime) != 2)
+		return -1;
+
+	return 0;
+}
+
+static bool proc_alive(pid_t pid, unsigned long long starttime)
+{
+	unsigned long long now_starttime;
+	char state;
+
+	if (proc_stat(pid, &state, &now_starttime) == -1)
+		return false;
+
+	return now_starttime == starttime && state != 'Z' && state != 'X';
+}
+
+/* returns the table locked, or NULL */
+static struct proctab *proctab_open(void)
+{
+	struct proctab *tab;
+	struct stat statbuf;
+	int fd;
+
+	fd = open(HOTPLUG_PROCTAB_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		err("%s: %s", HOTPLUG_PROCTAB_FILE, strerror(errno));
+		return NULL;
+	}
+	if (flock(fd, LOCK_EX) == -1 || fstat(fd, &statbuf) == -1)
+		goto err;
+	if (statbuf.st_size != sizeof(*tab) && ftruncate(fd, sizeof(*tab)) == -1)
+		goto err;
+
+	tab = mmap(NULL, sizeof(*tab), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (tab == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	/* a new file or one of another layout starts empty */
+	if (memcmp(tab->magic, "HPPT", 4) != 0 || tab->version != HOTPLUG_PROCTAB_VERSION) {
+		memset(tab, 0x00, sizeof(*tab));
+		tab->version = HOTPLUG_PROCTAB_VERSION;
+		memcpy(tab->magic, "HPPT", 4);
+	}
+	return tab;
+err:
+	err("%s: %s", HOTPLUG_PROCTAB_FILE, strerror(errno));
+	close(fd);
+	return NULL;
+}
+
+/* the lock is gone with the mapping */
+static void proctab_close(struct proctab *tab)
+{
+	munmap(tab, sizeof(*tab));
+}
+
+static struct proctab_entry *proctab_find(struct proctab *tab, const char *devpath)
+{
+	unsigned int i;
+
+	for (i = 0; i < HOTPLUG_PROCTAB_SLOTS; i++) {
+		if (tab->entries[i].pid != 0 && strcmp(tab->entries[i].devpath, devpath) == 0)
+			return &tab->entries[i];
+	}
+	return NULL;
+}
+
+int hotplug_proctab_add(const char *devpath, pid_t pid)
+{
+	struct proctab_entry *entry;
+	unsigned long long starttime;
+	struct proctab *tab;
+	unsigned int i;
+	char state;
+
+	/* the child exists from fork() on, exec does not change its start time */
+	if (proc_stat(pid, &state, &starttime) == -1)
+		return -1;
+
+	tab = proctab_open();
+	if (tab == NULL)
+		return -1;
+
+	entry = proctab_find(tab, devpath);
+	for (i = 0; entry == NULL && i < HOTPLUG_PROCTAB_SLOTS; i++) {
+		/* free slots, or ones of helpers which died unnoticed */
+		if (tab->entries[i].pid == 0 ||
+		    !proc_alive(tab->entries[i].pid, tab->entries[i].starttime))
+			entry = &tab->entries[i];
+	}
+	if (entry == NULL) {
+		err("more than %u helpers", HOTPLUG_PROCTAB_SLOTS);
+		proctab_close(tab);
+		return -1;
+	}
+
+	entry->pid = pid;
+	entry->starttime = starttime;
+	strlcpy(entry->devpath, devpath, sizeof(entry->devpath));
+	proctab_close(tab);
+	return 0;
+}
+
+int hotplug_proctab_take(const char *devpath, struct hotplug_proc *proc)
+{
+	struct proctab_entry *entry;
+	struct proctab *tab;
+	int ret = -1;
+
+	tab = proctab_open();
+	if (tab == NULL)
+		return -1;
+
+	entry = proctab_find(tab, devpath);
+	if (entry == NULL)
+		goto out;
+
+	proc->pid = entry->pid;
+	proc->starttime = entry->starttime;
+	proc->pidfd = -1;
+	entry->pid = 0;
+
+#if defined(SYS_pidfd_open)
+	proc->pidfd = syscall(SYS_pidfd_open, proc->pid, 0);
+#endif
+	/* checked after opening the pidfd, which then can't refer to another process */
+	if (!proc_alive(proc->pid, proc->starttime)) {
+		hotplug_proc_close(proc);
+		goto out;
+	}
+	ret = 0;
+out:
+	proctab_close(tab);
+	return ret;
+}
+
+int hotplug_proc_signal(const struct hotplug_proc *proc, int signum)
+{
+#if defined(SYS_pidfd_send_signal)
+	if (proc->pidfd != -1) {
+		if (syscall(SYS_pidfd_send_signal, proc->pidfd, signum, NULL, 0) == 0 || errno == ESRCH)
+			return 0;
+		if (errno != ENOSYS)
+			return -1;
+	}
+#endif
+	/* without pidfds, a pid can only be reused in the short window after this check */
+	if (!proc_alive(proc->pid, proc->starttime))
+		return 0;
+
+	return kill(proc->pid, signum);
+}
+
+bool hotplug_proc_gone(const struct hotplug_proc *proc)
+{
+	struct pollfd pfd;
+
+	/* reaps it, in case it's a child of this process */
+	waitpid(proc->pid, NULL, WNOHANG);
+
+	if (proc->pidfd != -1) {
+		pfd.fd = proc->pidfd;
+		pfd.events = POLLIN;
+		return poll(&pfd, 1, 0) == 1;
+	}
+
+	return !proc_alive(proc->pid, proc->starttime);
+}
+
+void hotplug_proc_close(struct hotplug_proc *proc)
+{
+	if (proc->pidfd != -1)
+		close(proc->pidfd);
+	proc->pidfd = -1;
+}
@@ -0,0 +1,30 @@
+#ifndef HOTPLUG_PROCTAB_H
+#define HOTPLUG_PROCTAB_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Helper processes like bdpoll, by devpath, in one shared file. An
+ * entry also keeps the start time of the process, so a pid which was
+ * reused meanwhile is never signalled.
+ */
+#define HOTPLUG_PROCTAB_FILE	"/var/run/hotplug.proctab"
+#define HOTPLUG_PROCTAB_SLOTS	64
+
+struct hotplug_proc {
+	pid_t pid;
+	unsigned long long starttime;		/* clock ticks after boot */
+	int pidfd;				/* -1 without pidfd support */
+};
+
+/* replaces the helper of devpath */
+int hotplug_proctab_add(const char *devpath, pid_t pid);
+/* removes the helper of devpath, 0 if it was still running */
+int hotplug_proctab_take(const char *devpath, struct hotplug_proc *proc);
+
+int hotplug_proc_signal(const struct hotplug_proc *proc, int signum);
+bool hotplug_proc_gone(const struct hotplug_proc *proc);
+void hotplug_proc_close(struct hotplug_proc *proc);
+
+#endif
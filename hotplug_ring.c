@@ -0,0 +1,308 @@
+/*
+    hotplug_ring.c
+
+    Lossy multi producer ring of records in a shared file, with futex
+    wakeups for readers.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "hotplug_ring.h"
+#include "udev.h"
+
+#define HOTPLUG_RING_VERSION	1
+/* the data area starts behind the header, at this offset */
+#define HOTPLUG_RING_DATA	64
+#define RING_ALIGN(len)		(((len) + 15) & ~15)
+
+static struct hotplug_ring_record *ring_at(const struct hotplug_ring *ring, uint32_t pos)
+{
+	return (struct hotplug_ring_record *)&ring->data[pos & (ring->size - 1)];
+}
+
+int hotplug_ring_open(struct hotplug_ring *ring, const char *path, size_t create_size)
+{
+	struct hotplug_ring_header *hdr;
+	struct stat statbuf;
+	uint32_t size;
+	int fd;
+
+	memset(ring, 0x00, sizeof(*ring));
+
+	fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC | (create_size ? O_CREAT : 0), 0644);
+	if (fd == -1)
+		return -1;
+
+	/* creators initialize under the lock, others wait for it */
+	if (flock(fd, create_size ? LOCK_EX : LOCK_SH) == -1 || fstat(fd, &statbuf) == -1)
+		goto err;
+	if (statbuf.st_size == 0 && create_size) {
+		if (create_size & (create_size - 1) || create_size > INT_MAX) {
+			errno = EINVAL;
+			goto err;
+		}
+		if (ftruncate(fd, HOTPLUG_RING_DATA + create_size) == -1)
+			goto err;
+		statbuf.st_size = HOTPLUG_RING_DATA + create_size;
+	}
+	/* root writes into it, so nobody else may own it */
+	if (statbuf.st_uid != 0 || !S_ISREG(statbuf.st_mode)) {
+		errno = EPERM;
+		goto err;
+	}
+	size = statbuf.st_size - HOTPLUG_RING_DATA;
+	if (statbuf.st_size <= HOTPLUG_RING_DATA || size & (size - 1) || size > INT_MAX) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	hdr = mmap(NULL, statbuf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err;
+
+	if (memcmp(hdr->magic, "HPRG", 4) != 0 && create_size) {
+		hdr->version = HOTPLUG_RING_VERSION;
+		hdr->size = size;
+		memcpy(hdr->magic, "HPRG", 4);
+	}
+	if (memcmp(hdr->magic, "HPRG", 4) != 0 || hdr->version != HOTPLUG_RING_VERSION ||
+	    hdr->size != size) {
+		munmap(hdr, statbuf.st_size);
+		errno = EINVAL;
+		goto err;
+	}
+	/* the mapping keeps the open file and so its lock */
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	ring->hdr = hdr;
+	ring->data = (char *)hdr + HOTPLUG_RING_DATA;
+	ring->map_size = statbuf.st_size;
+	ring->size = size;
+	ring->pos = hdr->head;
+	return 0;
+err:
+	close(fd);
+	return -1;
+}
+
+void hotplug_ring_close(struct hotplug_ring *ring)
+{
+	if (ring->hdr != NULL)
+		munmap(ring->hdr, ring->map_size);
+	ring->hdr = NULL;
+}
+
+static void ring_commit(struct hotplug_ring_record *rec, uint32_t pos)
+{
+	__sync_synchronize();
+	rec->check = ~pos;
+	rec->pos = pos;
+}
+
+static uint64_t ring_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int hotplug_ring_append(struct hotplug_ring *ring, const void *data, size_t len)
+{
+	struct hotplug_ring_header *hdr = ring->hdr;
+	struct hotplug_ring_record *rec;
+	uint32_t total = RING_ALIGN(sizeof(*rec) + len);
+	uint32_t head, to_end, pos;
+
+	if (len == 0 || total > ring->size / 2)
+		return -1;
+
+	/* reserve, with padding if the record does not fit before the end */
+	do {
+		head = *(volatile uint32_t *)&hdr->head;
+		/* records are aligned, unless someone else wrote to the file */
+		if (head & 15)
+			return -1;
+		to_end = ring->size - (head & (ring->size - 1));
+		pos = (total > to_end) ? head + to_end : head;
+	} while (!__sync_bool_compare_and_swap(&hdr->head, head, pos + total));
+
+	if (pos != head) {
+		rec = ring_at(ring, head);
+		rec->len = 0;
+		ring_commit(rec, head);
+	}
+
+	rec = ring_at(ring, pos);
+	rec->len = len;
+	rec->usec = ring_usec();
+	memcpy(rec->data, data, len);
+	ring_commit(rec, pos);
+
+	__sync_fetch_and_add(&hdr->futex, 1);
+	if (*(volatile uint32_t *)&hdr->waiters)
+		syscall(SYS_futex, &hdr->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+	return 0;
+}
+
+/* nothing written since pos was reserved for the last size bytes */
+static bool ring_intact(const struct hotplug_ring *ring, uint32_t pos)
+{
+	__sync_synchronize();
+	return *(volatile uint32_t *)&ring->hdr->head - pos <= ring->size;
+}
+
+static bool ring_committed(const struct hotplug_ring_record *rec, uint32_t pos)
+{
+	return *(volatile uint32_t *)&rec->pos == pos && *(volatile uint32_t *)&rec->check == ~pos;
+}
+
+/*
+ * The record at the reader position was reserved but is not committed.
+ * Once that lasted too long, continue at the next committed record, or
+ * at the head if there is none yet.
+ */
+static bool ring_skip_stalled(struct hotplug_ring *ring)
+{
+	uint64_t now = ring_usec();
+	uint32_t head, pos;
+
+	if (ring->stall_usec == 0) {
+		ring->stall_usec = now;
+		return false;
+	}
+	if (now - ring->stall_usec < HOTPLUG_RING_STALL_MS * 1000)
+		return false;
+
+	head = *(volatile uint32_t *)&ring->hdr->head;
+	for (pos = ring->pos + 16; pos != head; pos += 16) {
+		if (ring_committed(ring_at(ring, pos), pos))
+			break;
+	}
+	dbg("skipping uncommitted ring record at %u", ring->pos);
+	ring->pos = pos;
+	ring->stall_usec = 0;
+	return true;
+}
+
+const struct hotplug_ring_record *hotplug_ring_next(struct hotplug_ring *ring, unsigned long *lost)
+{
+	const struct hotplug_ring_record *rec;
+	uint32_t pos, len;
+
+	for (;;) {
+		pos = ring->pos;
+		if (*(volatile uint32_t *)&ring->hdr->head == pos)
+			return NULL;
+		if (!ring_intact(ring, pos) || pos & 15) {
+			/* overtaken, the only known record boundary is the head */
+			ring->pos = *(volatile uint32_t *)&ring->hdr->head;
+			ring->stall_usec = 0;
+			if (lost != NULL)
+				(*lost)++;
+			continue;
+		}
+
+		rec = ring_at(ring, pos);
+		if (!ring_committed(rec, pos)) {
+			if (!ring_skip_stalled(ring))
+				return NULL;
+			if (lost != NULL)
+				(*lost)++;
+			continue;
+		}
+		ring->stall_usec = 0;
+		__sync_synchronize();
+		len = rec->len;
+		if (!ring_intact(ring, pos))
+			continue;
+		/* a record must end before the end of the data area */
+		if ((pos & (ring->size - 1)) + RING_ALIGN(sizeof(*rec) + len) > ring->size) {
+			ring->pos = *(volatile uint32_t *)&ring->hdr->head;
+			if (lost != NULL)
+				(*lost)++;
+			continue;
+		}
+
+		if (len == 0) {
+			ring->pos = pos + ring->size - (pos & (ring->size - 1));
+			continue;
+		}
+		ring->pos = pos + RING_ALIGN(sizeof(*rec) + len);
+		return rec;
+	}
+}
+
+void hotplug_ring_rewind(struct hotplug_ring *ring)
+{
+	uint32_t head = *(volatile uint32_t *)&ring->hdr->head;
+	uint32_t pos;
+
+	/* records are aligned and name their own position */
+	pos = (head > ring->size) ? head - ring->size : 0;
+	for (; pos != head; pos += 16) {
+		if (ring_intact(ring, pos) && ring_committed(ring_at(ring, pos), pos))
+			break;
+	}
+	ring->pos = pos;
+	ring->stall_usec = 0;
+}
+
+bool hotplug_ring_valid(const struct hotplug_ring *ring, const struct hotplug_ring_record *rec)
+{
+	uint32_t pos;
+
+	/* the last record returned by hotplug_ring_next(), just before pos */
+	pos = ring->pos - RING_ALIGN(sizeof(*rec) + rec->len);
+	return ring_intact(ring, pos) && ring_committed(rec, pos);
+}
+
+int hotplug_ring_wait(struct hotplug_ring *ring, int timeout_ms)
+{
+	struct hotplug_ring_header *hdr = ring->hdr;
+	struct timespec ts;
+	uint32_t val;
+	int ret;
+
+	val = *(volatile uint32_t *)&hdr->futex;
+	__sync_synchronize();
+	if (ring->pos != *(volatile uint32_t *)&hdr->head &&
+	    (!ring_intact(ring, ring->pos) || ring_committed(ring_at(ring, ring->pos), ring->pos)))
+		return 0;
+
+	/* no append may come to wake a reader stalled behind a dead writer */
+	if (ring->stall_usec && (timeout_ms < 0 || timeout_ms > HOTPLUG_RING_STALL_MS))
+		timeout_ms = HOTPLUG_RING_STALL_MS;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+	__sync_fetch_and_add(&hdr->waiters, 1);
+	ret = syscall(SYS_futex, &hdr->futex, FUTEX_WAIT, val, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+	__sync_fetch_and_sub(&hdr->waiters, 1);
+
+	if (ret == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef HOTPLUG_RING_H
+#define HOTPLUG_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* events as sent to /tmp/hotplug.socket, if a consumer created the file */
+#define HOTPLUG_RING_EVENTS	"/dev/shm/hotplug.events"
+#define HOTPLUG_RING_SIZE	(256 * 1024)
+
+/*
+ * A lossy ring of records in a shared file. Any number of processes
+ * append, readers follow at their own position and notice when they were
+ * overtaken. Positions are free running byte offsets; a record is
+ * complete once its pos and check fields match its position.
+ */
+struct hotplug_ring_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t size;				/* of the data area, a power of two */
+	uint32_t head;				/* next free position */
+	uint32_t futex;				/* counts appends, readers wait on it */
+	uint32_t waiters;
+};
+
+struct hotplug_ring_record {
+	uint32_t pos;
+	uint32_t check;				/* ~pos */
+	uint32_t len;				/* of data, 0 for padding up to the end */
+	uint32_t reserved;
+	uint64_t usec;				/* CLOCK_MONOTONIC */
+	char data[];
+};
+
+struct hotplug_ring {
+	struct hotplug_ring_header *hdr;
+	char *data;
+	size_t map_size;
+	uint32_t size;				/* checked copy of hdr->size */
+	uint32_t pos;				/* reader position */
+	uint64_t stall_usec;			/* since pos was found uncommitted, or 0 */
+};
+
+int hotplug_ring_open(struct hotplug_ring *ring, const char *path, size_t create_size);
+void hotplug_ring_close(struct hotplug_ring *ring);
+int hotplug_ring_append(struct hotplug_ring *ring, const void *data, size_t len);
+
+/*
+ * Readers get records in place and must check them with
+ * hotplug_ring_valid() after use, they may be overwritten meanwhile.
+ * A record which stays uncommitted for HOTPLUG_RING_STALL_MS, because
+ * its writer died, is skipped and counted as lost.
+ */
+#define HOTPLUG_RING_STALL_MS	100
+
+const struct hotplug_ring_record *hotplug_ring_next(struct hotplug_ring *ring, unsigned long *lost);
+/* moves the reader back to the oldest record still in the ring */
+void hotplug_ring_rewind(struct hotplug_ring *ring);
+bool hotplug_ring_valid(const struct hotplug_ring *ring, const struct hotplug_ring_record *rec);
+int hotplug_ring_wait(struct hotplug_ring *ring, int timeout_ms);
+
+#endif
@@ -18,40 +18,317 @@
 */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include "hotplug_ring.h"
+#include "hotplug_socket.h"
+#include "hotplug_stats.h"
+#include "hotplug_timeout.h"
 #include "udev.h"
 
-void hotplug_socket_send_env(const char *vars[])
+#define HOTPLUG_SOCKET_MSG_SIZE	2048
+
+struct socket_msg {
+	char *buf;
+	size_t len;
+	char *key;				/* value of the coalescing key */
+	unsigned long long deadline;
+	bool retried;
+};
+
+struct hotplug_socket_stats hotplug_socket_stats;
+
+/* queued messages wait for the next flush instead of the deadline */
+static bool long_running;
+/* framed messages share one connection */
+static bool keep_conn;
+static int conn_fd = -1;
+
+/* ring of pending messages, the first one may be partially sent */
+static struct socket_msg queue[HOTPLUG_SOCKET_QUEUE_LEN];
+static unsigned int queue_head;
+static unsigned int queue_count;
+static size_t head_sent;
+
+void hotplug_socket_persistent(bool enable)
+{
+	long_running = enable;
+#if defined(HOTPLUG_SOCKET_FRAMED)
+	keep_conn = enable;
+#endif
+}
+
+static struct socket_msg *queue_at(unsigned int i)
+{
+	return &queue[(queue_head + i) % HOTPLUG_SOCKET_QUEUE_LEN];
+}
+
+static void msg_free(struct socket_msg *msg)
+{
+	free(msg->buf);
+	free(msg->key);
+	memset(msg, 0x00, sizeof(*msg));
+}
+
+/* remove entry i, keeping the order of the others */
+static void queue_remove(unsigned int i)
+{
+	msg_free(queue_at(i));
+	for (; i > 0; i--)
+		*queue_at(i) = *queue_at(i - 1);
+	memset(queue_at(0), 0x00, sizeof(struct socket_msg));
+	queue_head = (queue_head + 1) % HOTPLUG_SOCKET_QUEUE_LEN;
+	queue_count--;
+}
+
+static void conn_close(void)
+{
+	if (conn_fd != -1) {
+		close(conn_fd);
+		conn_fd = -1;
+	}
+	/* the rest of a message is useless on a new connection */
+	head_sent = 0;
+}
+
+/* returns -1 with errno EAGAIN if the consumer does not accept yet */
+static int socket_connect(void)
 {
 	struct sockaddr_un addr;
-	const char *var;
 	int s;
 
 	addr.sun_family = AF_LOCAL;
-	strcpy(addr.sun_path, "/tmp/hotplug.socket");
+	strcpy(addr.sun_path, HOTPLUG_SOCKET_PATH);
 
 	if ((s = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1) {
 		err("socket: %s", strerror(errno));
-		return;
+		return -1;
 	}
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	fcntl(s, F_SETFD, FD_CLOEXEC);
 
 	if (connect(s, (const struct sockaddr *)&addr, SUN_LEN(&addr)) == -1) {
-		err("connect: %s", strerror(errno));
-		goto exit;
+		if (errno != EAGAIN)
+			err("connect: %s", strerror(errno));
+		close(s);
+		return -1;
 	}
 
-	while (*vars != NULL) {
-		if ((var = getenv(*vars))) {
-			write(s, *vars, strlen(*vars));
-			write(s, "=", 1);
-			write(s, var, strlen(var) + 1);
+	return s;
+}
+
+/*
+ * Send as much of the queue as the consumer takes without blocking.
+ * Returns the number of messages left.
+ */
+static unsigned int queue_send(void)
+{
+	struct socket_msg *msg;
+	ssize_t ret;
+
+	while (queue_count > 0) {
+		msg = queue_at(0);
+
+		if (head_sent == 0 && timeout_now() > msg->deadline) {
+			hotplug_socket_stats.expired++;
+			queue_remove(0);
+			continue;
+		}
+
+		if (conn_fd == -1) {
+			conn_fd = socket_connect();
+			if (conn_fd == -1) {
+				if (errno == EAGAIN)
+					break;
+				/* nobody is listening */
+				hotplug_socket_stats.dropped++;
+				queue_remove(0);
+				continue;
+			}
 		}
-		vars++;
+
+		ret = send(conn_fd, &msg->buf[head_sent], msg->len - head_sent, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			/* the consumer went away, start over on a new connection */
+			err("send: %s", strerror(errno));
+			conn_close();
+			if (keep_conn && !msg->retried) {
+				msg->retried = true;
+				continue;
+			}
+			hotplug_socket_stats.dropped++;
+			queue_remove(0);
+			continue;
+		}
+
+		head_sent += ret;
+		if (head_sent < msg->len)
+			break;
+
+		hotplug_socket_stats.sent++;
+		head_sent = 0;
+		queue_remove(0);
+		if (!keep_conn)
+			conn_close();
 	}
-exit:
-	close(s);
+
+	return queue_count;
 }
 
+/* "KEY=value\0" for each set variable, behind a frame header if framed */
+static size_t msg_format(char *buf, size_t size, const char *vars[])
+{
+	struct hotplug_socket_frame frame;
+	size_t len = 0;
+	const char *var;
+	size_t keylen, varlen;
+
+#if defined(HOTPLUG_SOCKET_FRAMED)
+	len = sizeof(frame);
+#endif
+	for (; *vars != NULL; vars++) {
+		var = getenv(*vars);
+		if (var == NULL)
+			continue;
+		keylen = strlen(*vars);
+		varlen = strlen(var) + 1;
+		if (len + keylen + 1 + varlen > size)
+			break;
+		memcpy(&buf[len], *vars, keylen);
+		buf[len + keylen] = '=';
+		memcpy(&buf[len + keylen + 1], var, varlen);
+		len += keylen + 1 + varlen;
+	}
+
+#if defined(HOTPLUG_SOCKET_FRAMED)
+	frame.size = len - sizeof(frame);
+	memcpy(buf, &frame, sizeof(frame));
+#endif
+	return len;
+}
+
+static void queue_add(const char *buf, size_t len, const char *key)
+{
+	struct socket_msg *msg;
+	unsigned int i;
+
+	/* the partially sent head can not be replaced */
+	for (i = (head_sent > 0); key != NULL && i < queue_count; i++) {
+		msg = queue_at(i);
+		if (msg->key == NULL || strcmp(msg->key, key))
+			continue;
+		free(msg->buf);
+		msg->buf = malloc(len);
+		if (msg->buf == NULL) {
+			queue_remove(i);
+			hotplug_socket_stats.dropped++;
+			return;
+		}
+		memcpy(msg->buf, buf, len);
+		msg->len = len;
+		msg->deadline = timeout_now() + HOTPLUG_SOCKET_DEADLINE;
+		hotplug_socket_stats.coalesced++;
+		return;
+	}
+
+	if (queue_count == HOTPLUG_SOCKET_QUEUE_LEN) {
+		queue_remove(head_sent > 0);
+		hotplug_socket_stats.dropped++;
+	}
+
+	msg = queue_at(queue_count);
+	msg->buf = malloc(len);
+	msg->key = key ? strdup(key) : NULL;
+	if (msg->buf == NULL) {
+		msg_free(msg);
+		hotplug_socket_stats.dropped++;
+		return;
+	}
+	memcpy(msg->buf, buf, len);
+	msg->len = len;
+	msg->deadline = timeout_now() + HOTPLUG_SOCKET_DEADLINE;
+	queue_count++;
+}
+
+unsigned int hotplug_socket_flush(unsigned int ms)
+{
+	unsigned long long end = timeout_now() + ms;
+	unsigned long long now;
+	struct pollfd pfd;
+
+	while ((now = timeout_now()) < end) {
+		if (queue_send() == 0)
+			return end - now;
+		if (conn_fd == -1) {
+			/* the consumer does not accept yet, retry */
+			poll(NULL, 0, 10);
+			continue;
+		}
+		pfd.fd = conn_fd;
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, end - now);
+	}
+
+	return 0;
+}
+
+#if defined(HOTPLUG_RING)
+/* events are also appended to HOTPLUG_RING_EVENTS, once someone created it */
+static void ring_publish(const char *buf, size_t len)
+{
+	static struct hotplug_ring ring;
+
+#if defined(HOTPLUG_SOCKET_FRAMED)
+	buf += sizeof(struct hotplug_socket_frame);
+	len -= sizeof(struct hotplug_socket_frame);
+#endif
+	if (ring.hdr == NULL && hotplug_ring_open(&ring, HOTPLUG_RING_EVENTS, 0) == -1)
+		return;
+	hotplug_ring_append(&ring, buf, len);
+}
+#else
+static inline void ring_publish(const char *buf, size_t len)
+{
+}
+#endif
+
+void hotplug_socket_send_env_latest(const char *vars[], const char *key)
+{
+	unsigned long long start = hotplug_stats_now();
+	char buf[HOTPLUG_SOCKET_MSG_SIZE];
+	size_t len;
+
+	len = msg_format(buf, sizeof(buf), vars);
+	ring_publish(buf, len);
+	if (key != NULL)
+		key = getenv(key);
+
+	queue_add(buf, len, key);
+	if (queue_send() > 0) {
+		hotplug_socket_stats.queued++;
+		/* a short lived process has nothing better to do than to wait */
+		if (!long_running)
+			hotplug_socket_flush(HOTPLUG_SOCKET_DEADLINE);
+	}
+
+	hotplug_stats_add(HOTPLUG_STAGE_NOTIFY, start);
+}
+
+void hotplug_socket_send_env(const char *vars[])
+{
+	hotplug_socket_send_env_latest(vars, NULL);
+}
+
+void hotplug_socket_print_stats(void)
+{
+	info("socket: %lu sent, %lu queued, %lu coalesced, %lu dropped, %lu expired",
+	     hotplug_socket_stats.sent, hotplug_socket_stats.queued,
+	     hotplug_socket_stats.coalesced, hotplug_socket_stats.dropped,
+	     hotplug_socket_stats.expired);
+}
@@ -1,6 +1,62 @@
 #ifndef HOTPLUG_SOCKET_H
 #define HOTPLUG_SOCKET_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HOTPLUG_SOCKET_PATH	"/tmp/hotplug.socket"
+
+/*
+ * Without framing, every event is sent on its own connection as a list of
+ * NUL terminated "KEY=value" strings and ends with the connection.
+ * With -DHOTPLUG_SOCKET_FRAMED, this header precedes the same list, so
+ * that a connection can carry many events.
+ */
+struct hotplug_socket_frame {
+	uint32_t size;				/* bytes following the header */
+};
+
+/*
+ * Consumers of framed messages and of hotplugbroker also get SUBSYSTEM
+ * and SEQNUM. The plain messages keep the variables they always had.
+ */
+#if defined(HOTPLUG_SOCKET_FRAMED) || defined(HOTPLUGBROKER)
+#define HOTPLUG_SOCKET_EXTENDED
+#endif
+
+/* messages waiting for a slow consumer, the oldest is dropped first */
+#define HOTPLUG_SOCKET_QUEUE_LEN	16
+/* messages not sent after this many milliseconds are dropped */
+#define HOTPLUG_SOCKET_DEADLINE		2000
+
+struct hotplug_socket_stats {
+	unsigned long sent;
+	unsigned long queued;			/* had to wait for the consumer */
+	unsigned long coalesced;		/* replaced by a newer message */
+	unsigned long dropped;			/* queue full or no consumer */
+	unsigned long expired;			/* deadline exceeded */
+};
+
+extern struct hotplug_socket_stats hotplug_socket_stats;
+
+/*
+ * For long running processes: messages for a busy consumer stay queued
+ * until the next hotplug_socket_flush(). If framed, the connection is
+ * also kept open between events.
+ */
+void hotplug_socket_persistent(bool enable);
+
+/*
+ * Send the variables without blocking. In persistent mode the message is
+ * queued if the consumer is busy, otherwise the call waits at most until
+ * the deadline.
+ */
 void hotplug_socket_send_env(const char *vars[]);
+/* as above, a queued message with the same value of key is replaced */
+void hotplug_socket_send_env_latest(const char *vars[], const char *key);
+
+/* send queued messages for up to ms milliseconds, returns the time left */
+unsigned int hotplug_socket_flush(unsigned int ms);
+void hotplug_socket_print_stats(void);
 
 #endif
@@ -0,0 +1,149 @@
+/*
+    hotplug_state.c
+
+    Maintains HOTPLUG_STATE_FILE, the current state of all block devices.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "hotplug_state.h"
+#include "udev.h"
+
+#define HOTPLUG_STATE_LOCK	HOTPLUG_STATE_FILE ".lock"
+#define HOTPLUG_STATE_TMP	HOTPLUG_STATE_FILE ".tmp"
+
+struct state_entry {
+	int removable;
+	int cdrom;
+	int media;
+	unsigned long long seqnum;
+	unsigned long long generation;
+};
+
+enum state_op {
+	STATE_ADD,
+	STATE_MEDIA,
+	STATE_REMOVE,
+};
+
+/*
+ * Copy the file without the line of devpath, then append its new state.
+ * Writers serialize on the lock file, readers always see a complete file.
+ */
+static void state_update(const char *devpath, enum state_op op, const struct state_entry *update)
+{
+	char line[PATH_SIZE + 128];
+	char path[PATH_SIZE];
+	unsigned long long generation = 0;
+	struct state_entry entry, line_entry;
+	bool found = false;
+	FILE *in, *out;
+	char *end;
+	int lock;
+
+	lock = open(HOTPLUG_STATE_LOCK, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (lock == -1) {
+		err("%s: %s", HOTPLUG_STATE_LOCK, strerror(errno));
+		return;
+	}
+	if (flock(lock, LOCK_EX) == -1)
+		goto out;
+
+	out = fopen(HOTPLUG_STATE_TMP, "w");
+	if (out == NULL) {
+		err("%s: %s", HOTPLUG_STATE_TMP, strerror(errno));
+		goto out;
+	}
+
+	in = fopen(HOTPLUG_STATE_FILE, "r");
+	if (in != NULL && fgets(line, sizeof(line), in) != NULL)
+		sscanf(line, "# generation %llu", &generation);
+	generation++;
+	fprintf(out, "# generation %llu\n", generation);
+
+	while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+		/* the devpath may not fit into path in a corrupt file */
+		end = strchr(line, ' ');
+		if (end == NULL || end - line >= PATH_SIZE)
+			continue;
+		memcpy(path, line, end - line);
+		path[end - line] = '\0';
+		if (sscanf(end, "%i %i %i %llu %llu", &line_entry.removable, &line_entry.cdrom,
+			   &line_entry.media, &line_entry.seqnum, &line_entry.generation) != 5)
+			continue;
+		if (strcmp(path, devpath) == 0) {
+			entry = line_entry;
+			found = true;
+			continue;
+		}
+		fputs(line, out);
+	}
+	if (in != NULL)
+		fclose(in);
+
+	switch (op) {
+	case STATE_ADD:
+		entry = *update;
+		break;
+	case STATE_MEDIA:
+		/* bdpoll of a device which is gone already */
+		if (!found)
+			goto skip;
+		entry.media = update->media;
+		break;
+	case STATE_REMOVE:
+		goto skip;
+	}
+	entry.generation = generation;
+	fprintf(out, "%s %i %i %i %llu %llu\n", devpath, entry.removable, entry.cdrom,
+		entry.media, entry.seqnum, entry.generation);
+skip:
+	if (fclose(out) == EOF || rename(HOTPLUG_STATE_TMP, HOTPLUG_STATE_FILE) == -1) {
+		err("%s: %s", HOTPLUG_STATE_FILE, strerror(errno));
+		unlink(HOTPLUG_STATE_TMP);
+	}
+out:
+	close(lock);
+}
+
+void hotplug_state_add(const char *devpath, bool removable, bool cdrom, const char *seqnum)
+{
+	struct state_entry entry;
+
+	entry.removable = removable;
+	entry.cdrom = cdrom;
+	/* the media of fixed disks does not change, bdpoll watches the others */
+	entry.media = removable ? -1 : 1;
+	entry.seqnum = seqnum ? strtoull(seqnum, NULL, 10) : 0;
+	state_update(devpath, STATE_ADD, &entry);
+}
+
+void hotplug_state_media(const char *devpath, bool media)
+{
+	struct state_entry entry;
+
+	entry.media = media;
+	state_update(devpath, STATE_MEDIA, &entry);
+}
+
+void hotplug_state_remove(const char *devpath)
+{
+	state_update(devpath, STATE_REMOVE, NULL);
+}
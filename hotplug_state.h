@@ -0,0 +1,22 @@
+#ifndef HOTPLUG_STATE_H
+#define HOTPLUG_STATE_H
+
+#include <stdbool.h>
+
+/*
+ * Current state of the block devices, for consumers which start late:
+ *
+ *   # generation <n>
+ *   <devpath> <removable> <cdrom> <media> <seqnum> <generation>
+ *
+ * media is 1, 0 or -1 if not known yet, seqnum is the SEQNUM of the add
+ * event and generation the one of the last change of the line. The file
+ * is replaced atomically, the generation increases with every change.
+ */
+#define HOTPLUG_STATE_FILE	"/var/run/hotplug.state"
+
+void hotplug_state_add(const char *devpath, bool removable, bool cdrom, const char *seqnum);
+void hotplug_state_media(const char *devpath, bool media);
+void hotplug_state_remove(const char *devpath);
+
+#endif
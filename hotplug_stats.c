@@ -0,0 +1,364 @@
+/*
+    hotplug_stats.c
+
+    Per subsystem latency histograms of the stages of event handling,
+    accumulated by all hotplug processes in a shared file.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hotplug_stats.h"
+#include "udev.h"
+
+#define HOTPLUG_STATS_VERSION	1
+
+static const char *stats_subsystems[HOTPLUG_STATS_SUBSYSTEMS] = {
+	"block", "firmware", "ieee1394", "pci", "scsi", "usb", "other",
+};
+
+static const char *stats_actions[HOTPLUG_STATS_ACTIONS] = {
+	"add", "remove", "other",
+};
+
+static const char *stats_stages[HOTPLUG_STAGE_MAX] = {
+	[HOTPLUG_STAGE_RECEIVE] = "receive",
+	[HOTPLUG_STAGE_DISPATCH] = "dispatch",
+	[HOTPLUG_STAGE_MODPROBE] = "modprobe",
+	[HOTPLUG_STAGE_MKNOD] = "mknod",
+	[HOTPLUG_STAGE_NOTIFY] = "notify",
+	[HOTPLUG_STAGE_TOTAL] = "total",
+};
+
+/* the event handled by this process, subsystem is -1 outside of hotplug */
+static int stats_subsystem = -1;
+static int stats_action;
+static unsigned long long stats_spawned;
+static unsigned long long stats_usec[HOTPLUG_STAGE_MAX];
+static unsigned int stats_recorded;
+
+static unsigned long long clock_usec(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) == -1)
+		return 0;
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long long hotplug_stats_now(void)
+{
+	return clock_usec(CLOCK_MONOTONIC);
+}
+
+static int stats_index(const char *names[], int count, const char *name)
+{
+	int i;
+
+	if (name == NULL)
+		return count - 1;
+
+	for (i = 0; i < count - 1; i++)
+		if (strcmp(names[i], name) == 0)
+			break;
+
+	return i;
+}
+
+/* age of this process, from its start time in clock ticks after boot */
+static unsigned long long process_age(void)
+{
+	unsigned long long starttime;
+	unsigned long long now;
+	char buf[512];
+	const char *pos;
+	ssize_t len;
+	long hz;
+	int fd;
+	int i;
+
+	fd = open("/proc/self/stat", O_RDONLY);
+	if (fd == -1)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	/* skip "pid (comm)", starttime is the 20th field after it */
+	pos = strrchr(buf, ')');
+	for (i = 0; pos != NULL && i < 20; i++)
+		pos = strchr(&pos[1], ' ');
+	if (pos == NULL)
+		return 0;
+
+	hz = sysconf(_SC_CLK_TCK);
+	if (hz <= 0)
+		return 0;
+	now = clock_usec(CLOCK_BOOTTIME);
+	starttime = strtoull(pos, NULL, 10) * 1000000 / hz;
+	if (now == 0 || starttime > now)
+		return 0;
+
+	return now - starttime;
+}
+
+void hotplug_stats_begin(const char *subsystem, const char *action)
+{
+	unsigned long long now = hotplug_stats_now();
+	unsigned long long age;
+
+	stats_subsystem = stats_index(stats_subsystems, HOTPLUG_STATS_SUBSYSTEMS, subsystem);
+	stats_action = stats_index(stats_actions, HOTPLUG_STATS_ACTIONS, action);
+
+	/* tick resolution, but it is the only view on the kernel side */
+	age = process_age();
+	if (age != 0) {
+		stats_spawned = now - age;
+		hotplug_stats_add(HOTPLUG_STAGE_RECEIVE, stats_spawned);
+	} else
+		stats_spawned = now;
+}
+
+void hotplug_stats_add(enum hotplug_stage stage, unsigned long long start)
+{
+	if (stats_subsystem < 0 || start == 0)
+		return;
+
+	stats_usec[stage] += hotplug_stats_now() - start;
+	stats_recorded |= 1 << stage;
+}
+
+static unsigned int stats_bucket(uint32_t usec)
+{
+	unsigned int msb;
+
+	if (usec < HOTPLUG_STATS_SUB)
+		return usec;
+
+	msb = 31 - __builtin_clz(usec);
+	return (msb - 1) * HOTPLUG_STATS_SUB + ((usec >> (msb - 2)) & (HOTPLUG_STATS_SUB - 1));
+}
+
+/* lowest value which falls into bucket */
+static unsigned long stats_bucket_value(unsigned int bucket)
+{
+	unsigned int msb;
+
+	if (bucket < HOTPLUG_STATS_SUB)
+		return bucket;
+
+	msb = bucket / HOTPLUG_STATS_SUB + 1;
+	return (unsigned long)(HOTPLUG_STATS_SUB + bucket % HOTPLUG_STATS_SUB) << (msb - 2);
+}
+
+static void stats_hist_add(struct hotplug_stats_hist *hist, unsigned long long usec)
+{
+	uint32_t val = (usec > UINT32_MAX) ? UINT32_MAX : usec;
+
+	hist->count++;
+	hist->sum += val;
+	if (val > hist->max)
+		hist->max = val;
+	hist->buckets[stats_bucket(val)]++;
+}
+
+/* map the stats file, locked; an incompatible file is reset */
+static struct hotplug_stats_file *stats_map(int *fd, int flags)
+{
+	struct hotplug_stats_file *stats;
+	struct stat statbuf;
+	int prot = PROT_READ;
+
+	*fd = open(HOTPLUG_STATS_FILE, flags, 0644);
+	if (*fd == -1)
+		return NULL;
+
+	if (flock(*fd, (flags & O_RDWR) ? LOCK_EX : LOCK_SH) == -1)
+		goto err;
+
+	if (fstat(*fd, &statbuf) == -1)
+		goto err;
+	if ((size_t)statbuf.st_size != sizeof(*stats)) {
+		if (!(flags & O_RDWR))
+			goto err;
+		if (ftruncate(*fd, 0) == -1 || ftruncate(*fd, sizeof(*stats)) == -1)
+			goto err;
+	}
+
+	if (flags & O_RDWR)
+		prot |= PROT_WRITE;
+	stats = mmap(NULL, sizeof(*stats), prot, MAP_SHARED, *fd, 0);
+	if (stats == MAP_FAILED)
+		goto err;
+
+	if (memcmp(stats->magic, "HPST", 4) || stats->version != HOTPLUG_STATS_VERSION) {
+		if (!(flags & O_RDWR)) {
+			munmap(stats, sizeof(*stats));
+			goto err;
+		}
+		memset(stats, 0x00, sizeof(*stats));
+		memcpy(stats->magic, "HPST", 4);
+		stats->version = HOTPLUG_STATS_VERSION;
+	}
+
+	return stats;
+err:
+	close(*fd);
+	return NULL;
+}
+
+static void stats_unmap(struct hotplug_stats_file *stats, int fd)
+{
+	munmap(stats, sizeof(*stats));
+	close(fd);
+}
+
+void hotplug_stats_end(void)
+{
+	struct hotplug_stats_hist *hist;
+	struct hotplug_stats_file *stats;
+	int stage;
+	int fd;
+
+	if (stats_subsystem < 0)
+		return;
+	hotplug_stats_add(HOTPLUG_STAGE_TOTAL, stats_spawned);
+
+	/* concurrent hotplug processes serialize on the file lock */
+	stats = stats_map(&fd, O_RDWR | O_CREAT);
+	if (stats == NULL) {
+		dbg("unable to map " HOTPLUG_STATS_FILE ": %s", strerror(errno));
+		return;
+	}
+
+	hist = stats->hist[stats_subsystem][stats_action];
+	for (stage = 0; stage < HOTPLUG_STAGE_MAX; stage++)
+		if (stats_recorded & (1 << stage))
+			stats_hist_add(&hist[stage], stats_usec[stage]);
+
+	stats_unmap(stats, fd);
+	stats_subsystem = -1;
+}
+
+static unsigned long stats_percentile(const struct hotplug_stats_hist *hist, unsigned int p)
+{
+	unsigned long long rank = ((unsigned long long)hist->count * p + 99) / 100;
+	unsigned long long seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HOTPLUG_STATS_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			return stats_bucket_value(i);
+	}
+
+	return hist->max;
+}
+
+static void stats_print(const struct hotplug_stats_file *stats, int verbose)
+{
+	const struct hotplug_stats_hist *hist;
+	unsigned int i, j, k, b;
+
+	printf("%-9s %-7s %-9s %8s %9s %9s %9s %9s %9s\n", "SUBSYSTEM", "ACTION", "STAGE",
+	       "COUNT", "AVG", "P50", "P90", "P99", "MAX");
+
+	for (i = 0; i < HOTPLUG_STATS_SUBSYSTEMS; i++) {
+		for (j = 0; j < HOTPLUG_STATS_ACTIONS; j++) {
+			for (k = 0; k < HOTPLUG_STAGE_MAX; k++) {
+				hist = &stats->hist[i][j][k];
+				if (hist->count == 0)
+					continue;
+
+				printf("%-9s %-7s %-9s %8u %9llu %9lu %9lu %9lu %9u\n",
+				       stats_subsystems[i], stats_actions[j], stats_stages[k], hist->count,
+				       (unsigned long long)(hist->sum / hist->count),
+				       stats_percentile(hist, 50), stats_percentile(hist, 90),
+				       stats_percentile(hist, 99), hist->max);
+
+				if (!verbose)
+					continue;
+				for (b = 0; b < HOTPLUG_STATS_BUCKETS; b++)
+					if (hist->buckets[b] != 0)
+						printf("%28s>= %9lu %8u\n", "",
+						       stats_bucket_value(b), hist->buckets[b]);
+			}
+		}
+	}
+	printf("(latencies in microseconds, percentiles are bucket lower bounds)\n");
+}
+
+int hotplugstats(int argc, char *argv[], char *envp[])
+{
+	struct hotplug_stats_file *stats;
+	int verbose = 0;
+	int reset = 0;
+	int option;
+	int fd;
+
+	static const struct option options[] = {
+		{ "verbose", 0, NULL, 'v' },
+		{ "reset", 0, NULL, 'r' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "vrh", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'r':
+			reset = 1;
+			break;
+		case 'h':
+			printf("Usage: hotplugstats [--verbose] [--reset] [--help]\n"
+			       "  --verbose   print the histogram buckets\n"
+			       "  --reset     clear all histograms\n"
+			       "  --help\n\n");
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	stats = stats_map(&fd, reset ? O_RDWR | O_CREAT : O_RDONLY);
+	if (stats == NULL) {
+		fprintf(stderr, "no statistics in " HOTPLUG_STATS_FILE "\n");
+		return 1;
+	}
+
+	if (reset)
+		memset(stats->hist, 0x00, sizeof(stats->hist));
+	else
+		stats_print(stats, verbose);
+
+	stats_unmap(stats, fd);
+	return 0;
+}
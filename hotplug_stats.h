@@ -0,0 +1,57 @@
+#ifndef HOTPLUG_STATS_H
+#define HOTPLUG_STATS_H
+
+#include <stdint.h>
+
+#define HOTPLUG_STATS_FILE	"/var/run/hotplug.stats"
+
+/* stages of an event, in microseconds */
+enum hotplug_stage {
+	HOTPLUG_STAGE_RECEIVE,		/* kernel spawned the helper -> main() */
+	HOTPLUG_STAGE_DISPATCH,		/* subsystem handler */
+	HOTPLUG_STAGE_MODPROBE,		/* modprobe spawned -> finished */
+	HOTPLUG_STAGE_MKNOD,
+	HOTPLUG_STAGE_NOTIFY,		/* socket notification */
+	HOTPLUG_STAGE_TOTAL,		/* kernel spawned the helper -> handled */
+	HOTPLUG_STAGE_MAX,
+};
+
+/*
+ * Log-linear histogram: values below 4 have their own bucket, above that
+ * every power of two is split into 4 linear buckets.
+ */
+#define HOTPLUG_STATS_SUB	4
+#define HOTPLUG_STATS_BUCKETS	(31 * HOTPLUG_STATS_SUB)
+
+struct hotplug_stats_hist {
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[HOTPLUG_STATS_BUCKETS];
+};
+
+/* subsystems and actions with their own histograms, the last is "other" */
+#define HOTPLUG_STATS_SUBSYSTEMS	7
+#define HOTPLUG_STATS_ACTIONS		3
+
+struct hotplug_stats_file {
+	char magic[4];
+	uint32_t version;
+	struct hotplug_stats_hist hist[HOTPLUG_STATS_SUBSYSTEMS][HOTPLUG_STATS_ACTIONS][HOTPLUG_STAGE_MAX];
+};
+
+#if defined(HOTPLUG_STATS)
+void hotplug_stats_begin(const char *subsystem, const char *action);
+unsigned long long hotplug_stats_now(void);
+void hotplug_stats_add(enum hotplug_stage stage, unsigned long long start);
+void hotplug_stats_end(void);
+
+int hotplugstats(int argc, char *argv[], char *envp[]);
+#else
+static inline void hotplug_stats_begin(const char *subsystem, const char *action) {}
+static inline unsigned long long hotplug_stats_now(void) { return 0; }
+static inline void hotplug_stats_add(enum hotplug_stage stage, unsigned long long start) {}
+static inline void hotplug_stats_end(void) {}
+#endif
+
+#endif
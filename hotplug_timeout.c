@@ -17,26 +17,202 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
-#include <sys/time.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include "hotplug_timeout.h"
+#include "udev.h"
 
-static unsigned long timeout_ms(void)
+static struct hotplug_timer *heap[HOTPLUG_TIMER_MAX];
+static unsigned int heap_count;
+/* -2 until the first wait, -1 without timerfd support */
+static int timer_fd = -2;
+
+unsigned long long timeout_now(void)
 {
-	struct timeval tv;
+	struct timespec ts;
 
-	gettimeofday(&tv, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 void timeout_init(struct timeout *t, unsigned long ms)
 {
-	t->val = timeout_ms() + ms;
+	t->val = timeout_now() + ms;
 }
 
 int timeout_exceeded(struct timeout *t)
 {
-	return !((long)timeout_ms() - (long)t->val < 0);
+	return timeout_now() >= t->val;
+}
+
+unsigned int timeout_left(const struct timeout *t)
+{
+	unsigned long long now = timeout_now();
+
+	return (now < t->val) ? t->val - now : 0;
+}
+
+static void heap_set(unsigned int i, struct hotplug_timer *timer)
+{
+	heap[i] = timer;
+	timer->slot = i + 1;
+}
+
+static void heap_swap(unsigned int i, unsigned int j)
+{
+	struct hotplug_timer *timer = heap[i];
+
+	heap_set(i, heap[j]);
+	heap_set(j, timer);
+}
+
+static void heap_up(unsigned int i)
+{
+	while (i > 0 && heap[(i - 1) / 2]->expires > heap[i]->expires) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_down(unsigned int i)
+{
+	unsigned int min, child;
+
+	for (;;) {
+		min = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < heap_count; child++) {
+			if (heap[child]->expires < heap[min]->expires)
+				min = child;
+		}
+		if (min == i)
+			break;
+		heap_swap(i, min);
+		i = min;
+	}
+}
+
+static void heap_remove(unsigned int i)
+{
+	heap[i]->slot = 0;
+	if (i == --heap_count)
+		return;
+	heap_set(i, heap[heap_count]);
+	heap_down(i);
+	heap_up(i);
+}
+
+void hotplug_timer_add(struct hotplug_timer *timer, unsigned long ms, unsigned long interval)
+{
+	if (timer->slot != 0) {
+		heap_remove(timer->slot - 1);
+	} else if (heap_count == HOTPLUG_TIMER_MAX) {
+		err("more than %u timers", HOTPLUG_TIMER_MAX);
+		return;
+	}
+
+	timer->expires = timeout_now() + ms;
+	timer->interval = interval;
+	heap_set(heap_count, timer);
+	heap_up(heap_count++);
+}
+
+void hotplug_timer_del(struct hotplug_timer *timer)
+{
+	if (timer->slot != 0)
+		heap_remove(timer->slot - 1);
+}
+
+unsigned int hotplug_timer_left(const struct hotplug_timer *timer)
+{
+	struct timeout t = { .val = timer->expires };
+
+	return timeout_left(&t);
+}
+
+/* the earliest timer, if it expired */
+static struct hotplug_timer *timer_pop(unsigned long long now)
+{
+	struct hotplug_timer *timer;
+
+	if (heap_count == 0 || heap[0]->expires > now)
+		return NULL;
+
+	timer = heap[0];
+	if (timer->interval) {
+		/* periods missed meanwhile are skipped, not caught up */
+		timer->expires += ((now - timer->expires) / timer->interval + 1) * timer->interval;
+		heap_down(0);
+	} else {
+		heap_remove(0);
+	}
+	return timer;
+}
+
+static void timer_arm(void)
+{
+	struct itimerspec its;
+
+	if (timer_fd == -2)
+		timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timer_fd == -1)
+		return;
+
+	/* a zero it_value would disarm it */
+	memset(&its, 0x00, sizeof(its));
+	its.it_value.tv_sec = heap[0]->expires / 1000;
+	its.it_value.tv_nsec = (heap[0]->expires % 1000) * 1000000 + 1;
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		close(timer_fd);
+		timer_fd = -1;
+	}
 }
 
+struct hotplug_timer *hotplug_timer_wait(int fd, short events)
+{
+	struct hotplug_timer *timer;
+	struct pollfd pfd[2];
+	unsigned long long now;
+	unsigned int nfds;
+	uint64_t expirations;
+	int timeout;
+
+	for (;;) {
+		now = timeout_now();
+		timer = timer_pop(now);
+		if (timer != NULL)
+			return timer;
+
+		nfds = 0;
+		timeout = -1;
+		if (fd != -1) {
+			pfd[nfds].fd = fd;
+			pfd[nfds].events = events;
+			nfds++;
+		}
+		if (heap_count > 0) {
+			timer_arm();
+			if (timer_fd >= 0) {
+				pfd[nfds].fd = timer_fd;
+				pfd[nfds].events = POLLIN;
+				nfds++;
+			} else {
+				timeout = heap[0]->expires - now;
+			}
+		}
+
+		if (poll(pfd, nfds, timeout) == -1) {
+			if (errno != EINTR)
+				err("poll failed: %s", strerror(errno));
+			return NULL;
+		}
+		if (fd != -1 && pfd[0].revents)
+			return NULL;
+		if (timer_fd >= 0 && heap_count > 0 && pfd[nfds - 1].revents & POLLIN)
+			read(timer_fd, &expirations, sizeof(expirations));
+	}
+}
@@ -1,13 +1,40 @@
 #ifndef HOTPLUG_TIMEOUT_H
 #define HOTPLUG_TIMEOUT_H
 
+/* all times are CLOCK_MONOTONIC milliseconds, steps of the wall clock don't matter */
 struct timeout {
-	unsigned long val;
+	unsigned long long val;
 };
 
+unsigned long long timeout_now(void);
 void timeout_init(struct timeout *t, unsigned long ms);
 int timeout_exceeded(struct timeout *t);
+/* ms until the timeout, 0 once exceeded */
+unsigned int timeout_left(const struct timeout *t);
 
-#endif
+/*
+ * Timers of a process, kept in a heap by expiry. A timerfd is armed for
+ * the earliest one, so waiting blocks in the kernel until it expires.
+ * Periodic timers keep their phase: a late wait does not shift the
+ * following expiries.
+ */
+#define HOTPLUG_TIMER_MAX	8
+
+struct hotplug_timer {
+	unsigned long long expires;
+	unsigned long interval;			/* 0 for one shot timers */
+	unsigned int slot;			/* in the heap, 0 if not armed */
+};
 
+void hotplug_timer_add(struct hotplug_timer *timer, unsigned long ms, unsigned long interval);
+void hotplug_timer_del(struct hotplug_timer *timer);
+/* ms until the timer expires next, 0 if overdue */
+unsigned int hotplug_timer_left(const struct hotplug_timer *timer);
+/*
+ * Blocks until a timer expires or fd, if not -1, has any of events.
+ * Returns the expired timer, which is disarmed unless periodic, or NULL
+ * for the fd or a signal.
+ */
+struct hotplug_timer *hotplug_timer_wait(int fd, short events);
 
+#endif
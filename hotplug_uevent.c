@@ -0,0 +1,170 @@
+/*
+    hotplug_uevent.c
+
+    Indexes a uevent payload in a single pass.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <string.h>
+#include "hotplug_uevent.h"
+
+#define KEY_HASH_SIZE		64
+
+/*
+ * Perfect hash of the indexed keys: (key[1] + 4 * key[3] + len) & 63,
+ * all of them are at least four characters long. A key has to start
+ * with one of the letters in key_first to be looked up at all.
+ */
+#define KEY_HASH(key, len)	(((unsigned char)(key)[1] + 4 * (unsigned char)(key)[3] + (len)) & (KEY_HASH_SIZE - 1))
+
+static const unsigned int key_first =
+	(1 << ('A' - 'A')) | (1 << ('D' - 'A')) | (1 << ('F' - 'A')) | (1 << ('I' - 'A')) |
+	(1 << ('M' - 'A')) | (1 << ('P' - 'A')) | (1 << ('S' - 'A')) | (1 << ('T' - 'A'));
+
+static const struct {
+	const char *name;
+	enum uevent_key key;
+} key_hash[KEY_HASH_SIZE] = {
+	[2]  = { "MAJOR",		UEVENT_MAJOR },
+	[3]  = { "SEQNUM",		UEVENT_SEQNUM },
+	[4]  = { "DEVNAME",		UEVENT_DEVNAME },
+	[5]  = { "FIRMWARE",		UEVENT_FIRMWARE },
+	[10] = { "MINOR",		UEVENT_MINOR },
+	[12] = { "DEVPATH",		UEVENT_DEVPATH },
+	[16] = { "DEVPATH_OLD",		UEVENT_DEVPATH_OLD },
+	[27] = { "MODALIAS",		UEVENT_MODALIAS },
+	[28] = { "DEVTYPE",		UEVENT_DEVTYPE },
+	[30] = { "PHYSDEVBUS",		UEVENT_PHYSDEVBUS },
+	[31] = { "PHYSDEVPATH",		UEVENT_PHYSDEVPATH },
+	[33] = { "PHYSDEVDRIVER",	UEVENT_PHYSDEVDRIVER },
+	[36] = { "TIMEOUT",		UEVENT_TIMEOUT },
+	[41] = { "PRODUCT",		UEVENT_PRODUCT },
+	[42] = { "SUBSYSTEM",		UEVENT_SUBSYSTEM },
+	[43] = { "INTERFACE",		UEVENT_INTERFACE },
+	[45] = { "ACTION",		UEVENT_ACTION },
+	[48] = { "DRIVER",		UEVENT_DRIVER },
+	[49] = { "TYPE",		UEVENT_TYPE },
+};
+
+static int key_lookup(const char *key, size_t len)
+{
+	unsigned int first = (unsigned char)key[0] - 'A';
+	unsigned int hash;
+
+	if (len < 4 || first > 'Z' - 'A' || !(key_first & (1 << first)))
+		return -1;
+
+	hash = KEY_HASH(key, len);
+	if (key_hash[hash].name == NULL ||
+	    strncmp(key_hash[hash].name, key, len) != 0 ||
+	    key_hash[hash].name[len] != '\0')
+		return -1;
+
+	return key_hash[hash].key;
+}
+
+static void uevent_add(struct uevent *ev, const char *pos, const char *equal, const char *next)
+{
+	struct uevent_var *var;
+	int key;
+
+	/* the indexed keys are still found behind the last kept variable */
+	key = key_lookup(pos, equal - pos);
+	if (key >= 0)
+		ev->known[key] = equal + 1;
+
+	if (ev->count == UEVENT_MAX_VARS) {
+		ev->truncated = true;
+		return;
+	}
+	var = &ev->vars[ev->count++];
+	var->key = pos;
+	var->keylen = equal - pos;
+	var->value = equal + 1;
+	var->valuelen = next - var->value;
+}
+
+static void uevent_reset(struct uevent *ev)
+{
+	ev->header = NULL;
+	ev->count = 0;
+	ev->truncated = false;
+	memset(ev->known, 0x00, sizeof(ev->known));
+}
+
+/*
+ * Split a buffer of NUL separated "KEY=value" strings, optionally
+ * starting with a kernel "<action>@<devpath>" header. The buffer must
+ * stay valid as long as the event is used.
+ */
+int uevent_parse(struct uevent *ev, const char *buf, size_t len)
+{
+	const char *pos = buf;
+	const char *end = &buf[len];
+	const char *next;
+	const char *equal;
+
+	uevent_reset(ev);
+
+	while (pos < end && pos[0] != '\0') {
+		next = memchr(pos, '\0', end - pos);
+		if (next == NULL)
+			return -1;
+
+		equal = memchr(pos, '=', next - pos);
+		if (equal == NULL) {
+			if (pos == buf && memchr(pos, '@', next - pos) != NULL)
+				ev->header = pos;
+			pos = next + 1;
+			continue;
+		}
+
+		uevent_add(ev, pos, equal, next);
+		pos = next + 1;
+	}
+
+	return 0;
+}
+
+/* the same for the "KEY=value" strings of an environment, which must stay unchanged */
+void uevent_parse_env(struct uevent *ev, char *const envp[])
+{
+	const char *equal;
+	unsigned int i;
+
+	uevent_reset(ev);
+	for (i = 0; envp[i] != NULL; i++) {
+		equal = strchr(envp[i], '=');
+		if (equal != NULL)
+			uevent_add(ev, envp[i], equal, equal + strlen(equal));
+	}
+}
+
+const char *uevent_get(const struct uevent *ev, const char *key)
+{
+	size_t len = strlen(key);
+	unsigned int i;
+	int known;
+
+	known = key_lookup(key, len);
+	if (known >= 0)
+		return ev->known[known];
+
+	for (i = 0; i < ev->count; i++)
+		if (ev->vars[i].keylen == len && memcmp(ev->vars[i].key, key, len) == 0)
+			return ev->vars[i].value;
+
+	return NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef HOTPLUG_UEVENT_H
+#define HOTPLUG_UEVENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* keys which are indexed while parsing */
+enum uevent_key {
+	UEVENT_ACTION,
+	UEVENT_DEVPATH,
+	UEVENT_DEVPATH_OLD,
+	UEVENT_SUBSYSTEM,
+	UEVENT_SEQNUM,
+	UEVENT_MODALIAS,
+	UEVENT_DRIVER,
+	UEVENT_PHYSDEVPATH,
+	UEVENT_PHYSDEVDRIVER,
+	UEVENT_PHYSDEVBUS,
+	UEVENT_MAJOR,
+	UEVENT_MINOR,
+	UEVENT_DEVNAME,
+	UEVENT_DEVTYPE,
+	UEVENT_FIRMWARE,
+	UEVENT_PRODUCT,
+	UEVENT_TYPE,
+	UEVENT_INTERFACE,
+	UEVENT_TIMEOUT,
+	UEVENT_KEY_MAX,
+};
+
+#define UEVENT_MAX_VARS		64
+
+/* "KEY=value" inside the parsed buffer, the value is NUL terminated */
+struct uevent_var {
+	const char *key;
+	size_t keylen;
+	const char *value;
+	size_t valuelen;
+};
+
+struct uevent {
+	const char *header;			/* "<action>@<devpath>" or NULL */
+	unsigned int count;
+	bool truncated;				/* more than UEVENT_MAX_VARS, the rest is not in vars */
+	struct uevent_var vars[UEVENT_MAX_VARS];
+	const char *known[UEVENT_KEY_MAX];	/* values of the indexed keys */
+};
+
+/*
+ * Binary uevent records, as written by udevmonitor: this header in host
+ * byte order, followed by the raw message of "size" bytes.
+ */
+enum uevent_record_source {
+	UEVENT_RECORD_KERNEL = 1,
+	UEVENT_RECORD_UDEV = 2,
+};
+
+struct uevent_record {
+	uint32_t size;
+	uint32_t source;
+	uint64_t usec;				/* time of reception */
+};
+
+int uevent_parse(struct uevent *ev, const char *buf, size_t len);
+void uevent_parse_env(struct uevent *ev, char *const envp[]);
+const char *uevent_get(const struct uevent *ev, const char *key);
+
+#endif
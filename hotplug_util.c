@@ -24,6 +24,9 @@
 #include <string.h>
 #include <stdlib.h>	/* for exit() */
 #include <unistd.h>
+#include <sys/wait.h>
+#include "hotplug_prefetch.h"
+#include "hotplug_stats.h"
 #include "hotplug_util.h"
 #include "udev.h"
 
@@ -174,10 +177,22 @@ int split_3values (const char *string, int base, unsigned int * value1, unsigned
 	return 0;
 }
 
+bool hotplug_dry_run;
+
 int modprobe(const char *module_name, bool insert)
 {
+	unsigned long long start;
 	unsigned int i = 0;
 	char *argv[4];
+	pid_t pid;
+
+	if (hotplug_dry_run) {
+		info("dry run: %sloading module %s", insert ? "" : "un", module_name);
+		return 0;
+	}
+
+	if (insert)
+		hotplug_prefetch_record(HOTPLUG_PREFETCH_MODULE, module_name);
 
 	argv[i++] = "/sbin/modprobe";
 	if (!insert)
@@ -185,7 +200,9 @@ int modprobe(const char *module_name, bool insert)
 	argv[i++] = (char *)module_name;
 	argv[i++] = NULL;
 	dbg ("%sloading module %s", insert ? "" : "un", module_name);
-	switch (fork()) {
+	start = hotplug_stats_now();
+	pid = fork();
+	switch (pid) {
 		case 0:
 			/* we are the child, so lets run the program */
 			execv ("/sbin/modprobe", argv);
@@ -195,6 +212,11 @@ int modprobe(const char *module_name, bool insert)
 			dbg ("fork failed.");
 			break;
 		default:
+#if defined(HOTPLUG_STATS)
+			/* wait, to see when the module is loaded */
+			waitpid(pid, NULL, 0);
+			hotplug_stats_add(HOTPLUG_STAGE_MODPROBE, start);
+#endif
 			break;
 	}
 	return 0;
@@ -34,4 +34,7 @@ int split_3values(const char *string, int base, unsigned int *value1, unsigned i
 int split_2values(const char *string, int base, unsigned int *value1, unsigned int *value2);
 int modprobe(const char *module_name, bool insert);
 
+/* set by ueventreplay: log instead of touching modules, nodes and helpers */
+extern bool hotplug_dry_run;
+
 #endif
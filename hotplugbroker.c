@@ -0,0 +1,429 @@
+/*
+    hotplugbroker.c
+
+    Owns /tmp/hotplug.socket and fans the notifications of hotplug and
+    bdpoll out to any number of filtered subscribers.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "hotplug_netlink.h"
+#include "hotplug_socket.h"
+#include "hotplug_uevent.h"
+#include "hotplugbroker.h"
+#include "udev.h"
+
+/* events kept for subscribers which are behind */
+#define BROKER_EVENTS		256
+#define BROKER_EVENT_SIZE	2048
+#define BROKER_PRODUCERS	16
+#define BROKER_SUBSCRIBERS	32
+
+/* the message as sent to subscribers, with the values used for filtering */
+struct broker_event {
+	size_t len;
+	char buf[sizeof(struct hotplug_socket_frame) + BROKER_EVENT_SIZE];
+	const char *action;
+	const char *devpath;
+	const char *subsystem;
+};
+
+struct producer {
+	int fd;
+	size_t len;
+	char buf[sizeof(struct hotplug_socket_frame) + BROKER_EVENT_SIZE];
+};
+
+struct subscriber {
+	int fd;
+	bool ready;				/* filter complete */
+	size_t filter_len;
+	char filter_buf[512];
+	struct hotplug_netlink_filter filter;
+	unsigned long long next;		/* sequence number of the next event */
+	size_t sent;				/* bytes of it already sent */
+	unsigned long lost;
+};
+
+static struct broker_event ring[BROKER_EVENTS];
+static unsigned long long ring_head;
+static struct producer producers[BROKER_PRODUCERS];
+static struct subscriber subscribers[BROKER_SUBSCRIBERS];
+static volatile int broker_exit;
+
+static void asmlinkage sig_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		broker_exit = 1;
+}
+
+static int broker_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int s;
+
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_LOCAL;
+	strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	s = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if (s == -1) {
+		err("socket: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+
+	unlink(path);
+	if (bind(s, (const struct sockaddr *)&addr, SUN_LEN(&addr)) == -1 ||
+	    listen(s, BROKER_PRODUCERS) == -1) {
+		err("%s: %s", path, strerror(errno));
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+static int broker_accept(int listen_fd)
+{
+	int fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd == -1)
+		return -1;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+static void subscriber_close(struct subscriber *sub)
+{
+	info("subscriber %i gone, %lu events lost", sub->fd, sub->lost);
+	close(sub->fd);
+	hotplug_netlink_filter_cleanup(&sub->filter);
+	sub->fd = -1;
+}
+
+/* send what the subscriber takes without blocking, directly from the ring */
+static void subscriber_flush(struct subscriber *sub)
+{
+	struct broker_event *ev;
+	ssize_t ret;
+
+	if (sub->fd == -1 || !sub->ready)
+		return;
+
+	while (sub->next < ring_head) {
+		ev = &ring[sub->next % BROKER_EVENTS];
+		if (sub->sent == 0 &&
+		    !hotplug_netlink_filter_match(&sub->filter, ev->action, ev->devpath, ev->subsystem)) {
+			sub->next++;
+			continue;
+		}
+
+		ret = send(sub->fd, &ev->buf[sub->sent], ev->len - sub->sent, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				return;
+			subscriber_close(sub);
+			return;
+		}
+		sub->sent += ret;
+		if (sub->sent < ev->len)
+			return;
+		sub->sent = 0;
+		sub->next++;
+	}
+}
+
+static bool subscriber_pending(const struct subscriber *sub)
+{
+	return sub->fd != -1 && sub->ready && sub->next < ring_head;
+}
+
+/* the filter arrives as "KEY=value\0" strings, ended by "\0" */
+static void subscriber_read(struct subscriber *sub)
+{
+	char *pos, *next, *end;
+	ssize_t len;
+
+	len = read(sub->fd, &sub->filter_buf[sub->filter_len],
+		   sizeof(sub->filter_buf) - sub->filter_len);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0 || sub->ready) {
+		/* nothing is expected after the filter */
+		if (len <= 0)
+			subscriber_close(sub);
+		return;
+	}
+	sub->filter_len += len;
+
+	pos = sub->filter_buf;
+	end = &sub->filter_buf[sub->filter_len];
+	while (pos < end) {
+		next = memchr(pos, '\0', end - pos);
+		if (next == NULL)
+			break;
+		if (next == pos) {
+			sub->ready = true;
+			sub->filter_len = 0;
+			sub->next = ring_head;
+			info("subscriber %i ready", sub->fd);
+			return;
+		}
+		if (strncmp(pos, "SUBSYSTEM=", 10) == 0)
+			name_list_add(&sub->filter.subsystem_list, &pos[10], 0);
+		else if (strncmp(pos, "ACTION=", 7) == 0)
+			name_list_add(&sub->filter.action_list, &pos[7], 0);
+		else if (strncmp(pos, "DEVPATH=", 8) == 0)
+			name_list_add(&sub->filter.devpath_list, &pos[8], 0);
+		else
+			info("subscriber %i: unknown filter '%s'", sub->fd, pos);
+		pos = next + 1;
+	}
+
+	/* keep the incomplete rest */
+	sub->filter_len = end - pos;
+	memmove(sub->filter_buf, pos, sub->filter_len);
+	if (sub->filter_len == sizeof(sub->filter_buf)) {
+		err("subscriber %i: filter too long", sub->fd);
+		subscriber_close(sub);
+	}
+}
+
+static void ring_append(const char *payload, size_t len)
+{
+	struct hotplug_socket_frame frame;
+	struct broker_event *ev;
+	struct subscriber *sub;
+	struct uevent uev;
+	unsigned int i;
+
+	if (len == 0 || len > BROKER_EVENT_SIZE)
+		return;
+
+	/* the slot is reused: drop who is stuck in it, skip it for the others */
+	for (i = 0; i < BROKER_SUBSCRIBERS; i++) {
+		sub = &subscribers[i];
+		if (!subscriber_pending(sub) || sub->next + BROKER_EVENTS > ring_head)
+			continue;
+		if (sub->sent > 0) {
+			sub->lost++;
+			subscriber_close(sub);
+			continue;
+		}
+		sub->next++;
+		sub->lost++;
+	}
+
+	ev = &ring[ring_head % BROKER_EVENTS];
+	frame.size = len;
+	memcpy(ev->buf, &frame, sizeof(frame));
+	memcpy(&ev->buf[sizeof(frame)], payload, len);
+	ev->len = sizeof(frame) + len;
+
+	ev->action = NULL;
+	ev->devpath = NULL;
+	ev->subsystem = NULL;
+	if (uevent_parse(&uev, &ev->buf[sizeof(frame)], len) == 0) {
+		ev->action = uev.known[UEVENT_ACTION];
+		ev->devpath = uev.known[UEVENT_DEVPATH];
+		ev->subsystem = uev.known[UEVENT_SUBSYSTEM];
+	}
+	ring_head++;
+
+	for (i = 0; i < BROKER_SUBSCRIBERS; i++)
+		subscriber_flush(&subscribers[i]);
+}
+
+/* producers send one event per connection, or frames if built so */
+static void producer_read(struct producer *prod)
+{
+	struct hotplug_socket_frame frame;
+	ssize_t len;
+
+	len = read(prod->fd, &prod->buf[prod->len], sizeof(prod->buf) - prod->len);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (len > 0)
+		prod->len += len;
+#if defined(HOTPLUG_SOCKET_FRAMED)
+	while (prod->len >= sizeof(frame)) {
+		memcpy(&frame, prod->buf, sizeof(frame));
+		if (frame.size > BROKER_EVENT_SIZE) {
+			err("producer %i: frame of %u bytes", prod->fd, frame.size);
+			len = 0;
+			break;
+		}
+		if (prod->len < sizeof(frame) + frame.size)
+			break;
+		ring_append(&prod->buf[sizeof(frame)], frame.size);
+		prod->len -= sizeof(frame) + frame.size;
+		memmove(prod->buf, &prod->buf[sizeof(frame) + frame.size], prod->len);
+	}
+#else
+	if (len <= 0)
+		ring_append(prod->buf, prod->len);
+	else if (prod->len == sizeof(prod->buf)) {
+		err("producer %i: event too large", prod->fd);
+		len = 0;
+	}
+#endif
+	if (len <= 0) {
+		close(prod->fd);
+		prod->fd = -1;
+		prod->len = 0;
+	}
+}
+
+int hotplugbroker(int argc, char *argv[], char *envp[])
+{
+	struct pollfd pfd[2 + BROKER_PRODUCERS + BROKER_SUBSCRIBERS];
+	struct pollfd *producer_pfd[BROKER_PRODUCERS];
+	struct pollfd *subscriber_pfd[BROKER_SUBSCRIBERS];
+	struct sigaction act;
+	struct subscriber *sub;
+	int producer_sock;
+	int subscriber_sock;
+	unsigned int nfds;
+	unsigned int i;
+	int fd;
+	int retval = 1;
+
+	for (i = 0; i < BROKER_PRODUCERS; i++)
+		producers[i].fd = -1;
+	for (i = 0; i < BROKER_SUBSCRIBERS; i++)
+		subscribers[i].fd = -1;
+
+	producer_sock = broker_listen(HOTPLUG_SOCKET_PATH);
+	subscriber_sock = broker_listen(HOTPLUG_BROKER_PATH);
+	if (producer_sock == -1 || subscriber_sock == -1)
+		goto out;
+
+	memset(&act, 0x00, sizeof(struct sigaction));
+	act.sa_handler = (void (*)(int)) sig_handler;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+	log_level_signal();
+
+	while (!broker_exit) {
+		/* if all slots are busy, new producers wait in the backlog */
+		pfd[0].fd = producer_sock;
+		pfd[0].events = 0;
+		pfd[1].fd = subscriber_sock;
+		pfd[1].events = POLLIN;
+		nfds = 2;
+
+		for (i = 0; i < BROKER_PRODUCERS; i++) {
+			producer_pfd[i] = NULL;
+			if (producers[i].fd == -1) {
+				pfd[0].events = POLLIN;
+				continue;
+			}
+			producer_pfd[i] = &pfd[nfds++];
+			producer_pfd[i]->fd = producers[i].fd;
+			producer_pfd[i]->events = POLLIN;
+		}
+		for (i = 0; i < BROKER_SUBSCRIBERS; i++) {
+			subscriber_pfd[i] = NULL;
+			sub = &subscribers[i];
+			if (sub->fd == -1)
+				continue;
+			subscriber_pfd[i] = &pfd[nfds++];
+			subscriber_pfd[i]->fd = sub->fd;
+			subscriber_pfd[i]->events = POLLIN;
+			if (subscriber_pending(sub))
+				subscriber_pfd[i]->events |= POLLOUT;
+		}
+
+		if (poll(pfd, nfds, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			err("poll: %s", strerror(errno));
+			goto out;
+		}
+
+		for (i = 0; i < BROKER_PRODUCERS; i++)
+			if (producer_pfd[i] != NULL && producer_pfd[i]->revents)
+				producer_read(&producers[i]);
+
+		for (i = 0; i < BROKER_SUBSCRIBERS; i++) {
+			sub = &subscribers[i];
+			if (subscriber_pfd[i] == NULL || sub->fd == -1)
+				continue;
+			if (subscriber_pfd[i]->revents & (POLLIN | POLLHUP | POLLERR))
+				subscriber_read(sub);
+			if (subscriber_pfd[i]->revents & POLLOUT)
+				subscriber_flush(sub);
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			for (i = 0; i < BROKER_PRODUCERS; i++)
+				if (producers[i].fd == -1)
+					break;
+			if (i < BROKER_PRODUCERS && (fd = broker_accept(producer_sock)) != -1) {
+				producers[i].fd = fd;
+				producers[i].len = 0;
+			}
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			fd = broker_accept(subscriber_sock);
+			for (i = 0; fd != -1 && i < BROKER_SUBSCRIBERS; i++)
+				if (subscribers[i].fd == -1)
+					break;
+			if (fd != -1 && i == BROKER_SUBSCRIBERS) {
+				err("too many subscribers");
+				close(fd);
+			} else if (fd != -1) {
+				sub = &subscribers[i];
+				memset(sub, 0x00, sizeof(*sub));
+				sub->fd = fd;
+				hotplug_netlink_filter_init(&sub->filter);
+			}
+		}
+	}
+	retval = 0;
+
+out:
+	for (i = 0; i < BROKER_SUBSCRIBERS; i++)
+		if (subscribers[i].fd != -1)
+			subscriber_close(&subscribers[i]);
+	for (i = 0; i < BROKER_PRODUCERS; i++)
+		if (producers[i].fd != -1)
+			close(producers[i].fd);
+	if (producer_sock != -1) {
+		close(producer_sock);
+		unlink(HOTPLUG_SOCKET_PATH);
+	}
+	if (subscriber_sock != -1) {
+		close(subscriber_sock);
+		unlink(HOTPLUG_BROKER_PATH);
+	}
+	return retval;
+}
@@ -0,0 +1,15 @@
+#ifndef HOTPLUG_BROKER_H
+#define HOTPLUG_BROKER_H
+
+/*
+ * Subscribers connect here and send their filter as NUL terminated
+ * "SUBSYSTEM=<name>", "ACTION=<name>" and "DEVPATH=<prefix>" strings,
+ * ended by an empty string. Every key may be given more than once, an
+ * event passes if it matches one value of every given key. Events are
+ * then received as struct hotplug_socket_frame and the variables.
+ */
+#define HOTPLUG_BROKER_PATH	"/tmp/hotplug-broker.socket"
+
+int hotplugbroker(int argc, char *argv[], char *envp[]);
+
+#endif
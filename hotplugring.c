@@ -0,0 +1,125 @@
+/*
+    hotplugring.c
+
+    Creates HOTPLUG_RING_EVENTS and follows the events appended to it.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "hotplug_ring.h"
+#include "hotplugring.h"
+#include "udev.h"
+
+static volatile int ring_exit;
+
+static void asmlinkage sig_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		ring_exit = 1;
+}
+
+/* print the variables straight from the ring, they may change meanwhile */
+static void print_record(const struct hotplug_ring *ring, const struct hotplug_ring_record *rec)
+{
+	char buf[HOTPLUG_RING_SIZE / 2];
+	const char *var;
+	size_t len = rec->len;
+
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+	memcpy(buf, rec->data, len);
+	if (!hotplug_ring_valid(ring, rec)) {
+		printf("(overwritten)\n");
+		return;
+	}
+	buf[len - 1] = '\0';
+
+	printf("%llu.%06llu", (unsigned long long)rec->usec / 1000000,
+	       (unsigned long long)rec->usec % 1000000);
+	for (var = buf; var < &buf[len]; var += strlen(var) + 1)
+		printf(" %s", var);
+	printf("\n");
+}
+
+int hotplugring(int argc, char *argv[], char *envp[])
+{
+	const struct hotplug_ring_record *rec;
+	struct hotplug_ring ring;
+	struct sigaction act;
+	unsigned long lost = 0, reported = 0;
+	size_t create_size = 0;
+	int option;
+
+	static const struct option options[] = {
+		{ "create", 2, NULL, 'c' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "c::h", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 'c':
+			create_size = optarg ? strtoul(optarg, NULL, 0) : HOTPLUG_RING_SIZE;
+			break;
+		case 'h':
+			printf("Usage: hotplugring [--create[=<size>]] [--help]\n"
+			       "  --create    create " HOTPLUG_RING_EVENTS ", of %u bytes by default\n"
+			       "              hotplug and bdpoll append their events once it exists\n"
+			       "  --help\n\n", HOTPLUG_RING_SIZE);
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	if (hotplug_ring_open(&ring, HOTPLUG_RING_EVENTS, create_size) == -1) {
+		fprintf(stderr, HOTPLUG_RING_EVENTS ": %s\n", strerror(errno));
+		return 1;
+	}
+	if (create_size) {
+		hotplug_ring_close(&ring);
+		return 0;
+	}
+
+	memset(&act, 0x00, sizeof(struct sigaction));
+	act.sa_handler = (void (*)(int)) sig_handler;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	while (!ring_exit) {
+		rec = hotplug_ring_next(&ring, &lost);
+		if (lost != reported) {
+			printf("(overtaken %lu times)\n", lost);
+			reported = lost;
+		}
+		if (rec != NULL)
+			print_record(&ring, rec);
+		else if (hotplug_ring_wait(&ring, -1) == -1)
+			break;
+	}
+
+	hotplug_ring_close(&ring);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef HOTPLUGRING_H
+#define HOTPLUGRING_H
+
+int hotplugring(int argc, char *argv[], char *envp[]);
+
+#endif
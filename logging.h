@@ -27,39 +27,60 @@
 #define dbg(format, arg...)		do { } while (0)
 #define logging_init(foo)		do { } while (0)
 #define logging_close(foo)		do { } while (0)
+#define log_level_signal(foo)		do { } while (0)
 
 #ifdef USE_LOG
+#include <signal.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <syslog.h>
 
-#undef err
-#define err(format, arg...)							\
+/*
+ * Levels above the floor are compiled out, the others are checked against
+ * hotplug_log_level at runtime. The level is read from $HOTPLUG_LOG_LEVEL
+ * or "log_level=" in HOTPLUG_LOG_CONF, the floor is the default.
+ */
+#ifndef HOTPLUG_LOG_FLOOR
+#ifdef DEBUG
+#define HOTPLUG_LOG_FLOOR	LOG_DEBUG
+#else
+#define HOTPLUG_LOG_FLOOR	LOG_INFO
+#endif
+#endif
+
+#define HOTPLUG_LOG_CONF	"/etc/hotplug.conf"
+
+extern volatile sig_atomic_t hotplug_log_level;
+
+#define log_at(priority, format, arg...)					\
 	do {									\
-		log_message(LOG_ERR ,"%s: " format ,__FUNCTION__ ,## arg);	\
+		if ((priority) <= hotplug_log_level)				\
+			log_message(priority ,"%s: " format ,__FUNCTION__ ,## arg);	\
 	} while (0)
 
+#undef err
+#define err(format, arg...)		log_at(LOG_ERR, format ,## arg)
+
+#if HOTPLUG_LOG_FLOOR >= LOG_INFO
 #undef info
-#define info(format, arg...)							\
-	do {									\
-		log_message(LOG_INFO ,"%s: " format ,__FUNCTION__ ,## arg);	\
-	} while (0)
+#define info(format, arg...)		log_at(LOG_INFO, format ,## arg)
+#endif
 
-#ifdef DEBUG
+#if HOTPLUG_LOG_FLOOR >= LOG_DEBUG
 #undef dbg
-#define dbg(format, arg...)							\
-	do {									\
-		log_message(LOG_DEBUG ,"%s: " format ,__FUNCTION__ ,## arg);	\
-	} while (0)
+#define dbg(format, arg...)		log_at(LOG_DEBUG, format ,## arg)
 #endif
 
 extern void log_message(int priority, const char *format, ...)
 	__attribute__ ((format (printf, 2, 3)));
+extern void log_level_init(void);
+extern void log_level_cycle(int signum);
 
 #undef logging_init
 static inline void logging_init(const char *program_name)
 {
 	openlog(program_name, LOG_PID | LOG_CONS, LOG_DAEMON);
+	log_level_init();
 }
 
 #undef logging_close
@@ -68,6 +89,13 @@ static inline void logging_close(void)
 	closelog();
 }
 
+/* for long running processes: SIGUSR2 steps through err, info and debug, up to the floor */
+#undef log_level_signal
+static inline void log_level_signal(void)
+{
+	signal(SIGUSR2, log_level_cycle);
+}
+
 #endif	/* USE_LOG */
 
 #endif
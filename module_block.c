@@ -24,24 +24,35 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include "hotplug_basename.h"
 #include "hotplug_devpath.h"
-#include "hotplug_pidfile.h"
+#include "hotplug_proctab.h"
 #include "hotplug_setenv.h"
 #include "hotplug_socket.h"
+#include "hotplug_state.h"
+#include "hotplug_stats.h"
 #include "hotplug_timeout.h"
+#include "hotplug_util.h"
 #include "module_block.h"
 #include "udev.h"
 
+/* bdpoll gets SIGKILL if it is still there after the grace period */
+#define BDPOLL_KILL_GRACE	1000
+#define BDPOLL_KILL_CHECK	10
+
 static const char *block_vars[] = {
 	"ACTION",
 	"DEVPATH",
+#if defined(HOTPLUG_SOCKET_EXTENDED)
+	"SUBSYSTEM",
+	"SEQNUM",
+#endif
 	"PHYSDEVPATH",
 	"PHYSDEVDRIVER",
 	"X_E2_REMOVABLE",
@@ -71,49 +82,56 @@ static int bdpoll_exec(const char devpath[], bool is_cdrom, bool support_media_c
 			perror(argv[0]);
 		return -1;
 	} else {
-		return pidfile_write(pid, "bdpoll.%s", hotplug_basename(devpath));
+		return hotplug_proctab_add(devpath, pid);
 	}
 }
 
 static int bdpoll_kill(const char devpath[])
 {
-	struct timeout t;
-	pid_t pid, wpid;
+	struct hotplug_timer check = { .slot = 0 };
+	struct hotplug_timer grace = { .slot = 0 };
+	struct hotplug_proc proc;
+	int ret = 0;
 
-	if (pidfile_read(&pid, "bdpoll.%s", hotplug_basename(devpath)) == -1)
+	if (hotplug_proctab_take(devpath, &proc) == -1)
 		return -1;
 
-	if (kill(pid, SIGTERM) == -1) {
+	if (hotplug_proc_signal(&proc, SIGTERM) == -1) {
 		perror("kill");
+		hotplug_proc_close(&proc);
 		return -1;
 	}
 
-	timeout_init(&t, 1000);
-	do {
-		wpid = waitpid(pid, NULL, WNOHANG);
-		if (wpid == -1) {
-			perror("waitpid");
-			return -1;
+	/* a pidfd becomes readable when the process ends, without it check periodically */
+	if (proc.pidfd == -1)
+		hotplug_timer_add(&check, BDPOLL_KILL_CHECK, BDPOLL_KILL_CHECK);
+	hotplug_timer_add(&grace, BDPOLL_KILL_GRACE, 0);
+	while (!hotplug_proc_gone(&proc)) {
+		if (hotplug_timer_wait(proc.pidfd, POLLIN) != &grace)
+			continue;
+		if (hotplug_proc_signal(&proc, SIGKILL) == -1) {
+			perror("kill");
+			ret = -1;
 		}
-		if (wpid > 0)
-			goto exit;
-	} while (!timeout_exceeded(&t));
-
-	if (kill(pid, SIGKILL) == -1) {
-		perror("kill");
-		return -1;
+		break;
 	}
+	hotplug_timer_del(&check);
+	hotplug_timer_del(&grace);
+	hotplug_proc_close(&proc);
 
-exit:
-	pidfile_unlink("bdpoll.%s", hotplug_basename(devpath));
-	return 0;
+	return ret;
 }
 
 static int do_mknod(const char *devnode, const char *major, const char *minor)
 {
 	dev_t dev = (atoi(major) << 8) | atoi(minor);
+	unsigned long long start = hotplug_stats_now();
+	int ret;
 
-	return mknod(devnode, S_IFBLK | S_IRUSR | S_IWUSR, dev);
+	ret = mknod(devnode, S_IFBLK | S_IRUSR | S_IWUSR, dev);
+	hotplug_stats_add(HOTPLUG_STAGE_MKNOD, start);
+
+	return ret;
 }
 
 static long sysfs_attr_get_long(const char *devpath, const char *attr_name)
@@ -239,6 +257,16 @@ int block_add(void)
 		return EXIT_FAILURE;
 	}
 
+	is_removable = dev_is_removable(devpath);
+	is_cdrom = is_removable && dev_is_cdrom(devpath);
+	support_media_changed = is_cdrom && dev_can_notify_media_change(devpath);
+
+	if (hotplug_dry_run) {
+		info("dry run: mknod %s %s:%s%s", devnode, major, minor,
+		     is_removable ? ", bdpoll" : "");
+		return EXIT_SUCCESS;
+	}
+
 	unlink(devnode);
 
 	if (do_mknod(devnode, major, minor) == -1) {
@@ -246,9 +274,8 @@ int block_add(void)
 		return EXIT_FAILURE;
 	}
 
-	is_removable = dev_is_removable(devpath);
-	is_cdrom = is_removable && dev_is_cdrom(devpath);
-	support_media_changed = is_cdrom && dev_can_notify_media_change(devpath);
+	/* before bdpoll starts to update the media status */
+	hotplug_state_add(devpath, is_removable, is_cdrom, getenv("SEQNUM"));
 
 	if (is_removable) {
 		if (bdpoll_exec(devpath, is_cdrom, support_media_changed) == -1)
@@ -279,11 +306,18 @@ int block_remove(void)
 		return EXIT_FAILURE;
 	}
 
+	if (hotplug_dry_run) {
+		info("dry run: unlink %s", devnode);
+		return EXIT_SUCCESS;
+	}
+
 	unlink(devnode);
 
 	if (bdpoll_kill(devpath) == -1)
 		dbg("could not kill bdpoll");
 
+	hotplug_state_remove(devpath);
+
 	hotplug_socket_send_env(block_vars);
 
 	return EXIT_SUCCESS;
@@ -25,7 +25,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
+#if defined(USE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(USE_LZMA)
+#include <lzma.h>
+#endif
+#include "hotplug_firmware_cache.h"
+#include "hotplug_pidfile.h"
+#include "hotplug_prefetch.h"
+#include "hotplug_util.h"
 #include "module_firmware.h"
 #include "udev.h"
 
@@ -46,6 +58,111 @@ static int fw_open(const char *fmt, const char *str, int flags)
 	return fd;
 }
 
+/* the order of the kernel's own firmware loader */
+static const struct {
+	const char *dir;
+	bool release;				/* append the kernel release */
+} fw_search_path[] = {
+	{ FIRMWARE_DIR "/updates", true },
+	{ FIRMWARE_DIR "/updates", false },
+	{ FIRMWARE_DIR, true },
+	{ FIRMWARE_DIR, false },
+};
+
+#define FIRMWARE_DIRS_MAX	(1 + sizeof(fw_search_path) / sizeof(fw_search_path[0]))
+
+static int fw_dirs[FIRMWARE_DIRS_MAX];
+static int fw_ndirs = -1;
+
+static void fw_dir_add(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		dbg("skipping '%s': %s", path, strerror(errno));
+		return;
+	}
+	fw_dirs[fw_ndirs++] = fd;
+}
+
+/* open every existing directory once, later lookups are one openat each */
+static void fw_dirs_init(void)
+{
+	char path[PATH_SIZE];
+	struct utsname uts;
+	const char *custom;
+	unsigned int i;
+
+	fw_ndirs = 0;
+
+	/* firmware_class.path= */
+	custom = sysfs_attr_get_value("/module/firmware_class/parameters", "path");
+	if (custom != NULL && custom[0] != '\0')
+		fw_dir_add(custom);
+
+	if (uname(&uts) == -1)
+		uts.release[0] = '\0';
+	for (i = 0; i < sizeof(fw_search_path) / sizeof(fw_search_path[0]); i++) {
+		strlcpy(path, fw_search_path[i].dir, sizeof(path));
+		if (fw_search_path[i].release) {
+			if (uts.release[0] == '\0')
+				continue;
+			strlcat(path, "/", sizeof(path));
+			strlcat(path, uts.release, sizeof(path));
+		}
+		fw_dir_add(path);
+	}
+}
+
+/* the plain file is preferred in all directories, like the kernel does */
+static const char *fw_suffix[] = {
+	[FIRMWARE_PLAIN] = "",
+#if defined(USE_ZLIB)
+	[FIRMWARE_GZ] = ".gz",
+#endif
+#if defined(USE_LZMA)
+	[FIRMWARE_XZ] = ".xz",
+#endif
+};
+
+int firmware_open(const char *name, struct stat *st, enum firmware_format *format)
+{
+	char path[PATH_SIZE];
+	unsigned int f;
+	int fd;
+	int i;
+
+	/* names are relative to the search path */
+	if (name[0] == '/' || strstr(name, "../") != NULL) {
+		dbg("invalid firmware name '%s'", name);
+		return -1;
+	}
+
+	if (fw_ndirs == -1)
+		fw_dirs_init();
+
+	for (f = 0; f < sizeof(fw_suffix) / sizeof(fw_suffix[0]); f++) {
+		if (fw_suffix[f] == NULL)
+			continue;
+		strlcpy(path, name, sizeof(path));
+		strlcat(path, fw_suffix[f], sizeof(path));
+		for (i = 0; i < fw_ndirs; i++) {
+			fd = openat(fw_dirs[i], path, O_RDONLY | O_CLOEXEC);
+			if (fd == -1)
+				continue;
+			if (fstat(fd, st) == 0 && S_ISREG(st->st_mode)) {
+				*format = f;
+				return fd;
+			}
+			close(fd);
+		}
+	}
+
+	dbg("firmware '%s' not found", name);
+	return -1;
+}
+
 static int fw_write(int fd, const char *buf, size_t count)
 {
 	size_t off;
@@ -62,49 +179,246 @@ static int fw_write(int fd, const char *buf, size_t count)
 	return count;
 }
 
-int firmware_add(void)
+static int fw_upload_mmap(int dst_fd, int src_fd, off_t off, off_t size, size_t chunk)
 {
-	char *devpath_env;
-	char *firmware_env;
+	char *src_ptr;
+	size_t len;
+	int ret = 0;
+
+	src_ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, src_fd, 0);
+	if (src_ptr == MAP_FAILED) {
+		dbg("mmap failed: %s", strerror(errno));
+		return -1;
+	}
+	madvise(src_ptr, size, MADV_SEQUENTIAL);
+
+	for (; off < size; off += len) {
+		len = (size - off < (off_t)chunk) ? (size_t)(size - off) : chunk;
+		if (fw_write(dst_fd, &src_ptr[off], len) == -1) {
+			ret = -1;
+			break;
+		}
+	}
+
+	munmap(src_ptr, size);
+	return ret;
+}
+
+int firmware_upload(int dst_fd, int src_fd, off_t size, size_t chunk, enum firmware_upload *method)
+{
+	off_t off = 0;
+	ssize_t ret;
+
+	if (chunk == 0)
+		chunk = FIRMWARE_CHUNK_SIZE;
+
+	while (*method == FIRMWARE_UPLOAD_SENDFILE && off < size) {
+		ret = sendfile(dst_fd, src_fd, &off, (size - off < (off_t)chunk) ? (size_t)(size - off) : chunk);
+		if (ret > 0 || (ret == -1 && errno == EINTR))
+			continue;
+		/* before 2.6.33 only sockets, and sysfs may not support splicing */
+		if (ret == -1 && (errno == EINVAL || errno == ENOSYS)) {
+			dbg("sendfile failed, using mmap: %s", strerror(errno));
+			*method = FIRMWARE_UPLOAD_MMAP;
+			break;
+		}
+		dbg("sendfile failed: %s", ret ? strerror(errno) : "file truncated");
+		return -1;
+	}
+
+	/* the data file is written sequentially, so continue where sendfile stopped */
+	if (off < size)
+		return fw_upload_mmap(dst_fd, src_fd, off, size, chunk);
+
+	return 0;
+}
+
+#if defined(USE_ZLIB)
+static int fw_gunzip(int dst_fd, int src_fd, char *in, char *out, size_t chunk, off_t max_size)
+{
+	z_stream z;
+	off_t off = 0;
+	ssize_t len;
+	int ret;
+
+	memset(&z, 0x00, sizeof(z));
+	/* 32 detects the gzip header */
+	if (inflateInit2(&z, 15 + 32) != Z_OK)
+		return -1;
+
+	do {
+		if (z.avail_in == 0) {
+			len = pread(src_fd, in, chunk, off);
+			if (len <= 0) {
+				dbg("read failed: %s", len ? strerror(errno) : "file truncated");
+				ret = Z_DATA_ERROR;
+				break;
+			}
+			off += len;
+			z.next_in = (unsigned char *)in;
+			z.avail_in = len;
+		}
+		z.next_out = (unsigned char *)out;
+		z.avail_out = chunk;
+		ret = inflate(&z, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			dbg("inflate failed: %s", z.msg ? z.msg : "unknown error");
+			break;
+		}
+		if (max_size && (off_t)z.total_out > max_size) {
+			errno = EFBIG;
+			ret = Z_ERRNO;
+			break;
+		}
+		if (fw_write(dst_fd, out, chunk - z.avail_out) == -1) {
+			ret = Z_ERRNO;
+			break;
+		}
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&z);
+	return (ret == Z_STREAM_END) ? 0 : -1;
+}
+#endif
+
+#if defined(USE_LZMA)
+static int fw_unxz(int dst_fd, int src_fd, char *in, char *out, size_t chunk, off_t max_size)
+{
+	lzma_stream z = LZMA_STREAM_INIT;
+	lzma_action action = LZMA_RUN;
+	off_t off = 0;
+	ssize_t len;
+	lzma_ret ret;
+
+	if (lzma_stream_decoder(&z, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+		return -1;
+
+	do {
+		if (z.avail_in == 0 && action == LZMA_RUN) {
+			len = pread(src_fd, in, chunk, off);
+			if (len < 0) {
+				dbg("read failed: %s", strerror(errno));
+				ret = LZMA_DATA_ERROR;
+				break;
+			}
+			off += len;
+			z.next_in = (uint8_t *)in;
+			z.avail_in = len;
+			if (len == 0)
+				action = LZMA_FINISH;
+		}
+		z.next_out = (uint8_t *)out;
+		z.avail_out = chunk;
+		ret = lzma_code(&z, action);
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			dbg("xz decoding failed: %d", ret);
+			break;
+		}
+		if (max_size && z.total_out > (uint64_t)max_size) {
+			errno = EFBIG;
+			ret = LZMA_PROG_ERROR;
+			break;
+		}
+		if (fw_write(dst_fd, out, chunk - z.avail_out) == -1) {
+			ret = LZMA_PROG_ERROR;
+			break;
+		}
+	} while (ret != LZMA_STREAM_END);
+
+	lzma_end(&z);
+	return (ret == LZMA_STREAM_END) ? 0 : -1;
+}
+#endif
+
+int firmware_decompress(int dst_fd, int src_fd, size_t chunk, enum firmware_format format,
+			off_t max_size)
+{
+	char *in, *out;
+	int ret = -1;
+
+	if (chunk == 0)
+		chunk = FIRMWARE_CHUNK_SIZE;
+
+	/* no more than these two chunks are held in memory */
+	in = malloc(chunk);
+	out = malloc(chunk);
+	if (in == NULL || out == NULL)
+		goto out;
+
+	switch (format) {
+#if defined(USE_ZLIB)
+	case FIRMWARE_GZ:
+		ret = fw_gunzip(dst_fd, src_fd, in, out, chunk, max_size);
+		break;
+#endif
+#if defined(USE_LZMA)
+	case FIRMWARE_XZ:
+		ret = fw_unxz(dst_fd, src_fd, in, out, chunk, max_size);
+		break;
+#endif
+	default:
+		dbg("unsupported firmware format %d", format);
+		break;
+	}
+out:
+	free(out);
+	free(in);
+	return ret;
+}
+
+int firmware_load(const char *devpath_env, const char *firmware_env)
+{
+	char devpath[PATH_SIZE];
 	int load_fd = -1;
 	int src_fd = -1;
+	int cache_fd = -1;
 	int dst_fd = -1;
-	void *src_ptr = MAP_FAILED;
-	struct stat st;
+	enum firmware_upload method = FIRMWARE_UPLOAD_SENDFILE;
+	enum firmware_format format = FIRMWARE_PLAIN;
+	struct stat st, cache_st;
 	int ret = 0;
 
-	devpath_env = getenv("DEVPATH");
-	firmware_env = getenv("FIRMWARE");
-	dbg("DEVPATH='%s', FIRMWARE = '%s'", devpath_env, firmware_env);
-	if ((devpath_env == NULL) ||
-	    (firmware_env == NULL)) {
-		dbg("missing an environment variable, aborting.");
-		return 1;
-	}
+	sysfs_init();
+	strlcpy(devpath, sysfs_path, sizeof(devpath));
+	strlcat(devpath, devpath_env, sizeof(devpath));
 
-	load_fd = fw_open("/sys%s/loading", devpath_env, O_WRONLY);
-	src_fd = fw_open("/lib/firmware/%s", firmware_env, O_RDONLY);
-	dst_fd = fw_open("/sys%s/data", devpath_env, O_WRONLY);
-	if ((load_fd == -1) || (src_fd == -1) || (dst_fd == -1))
-		goto err;
+	/* resolve the firmware first, the kernel waits as soon as loading is set */
+	src_fd = firmware_open(firmware_env, &st, &format);
 
-	if (fstat(src_fd, &st) == -1) {
-		dbg("stat failed: %s", strerror(errno));
-		goto err;
+	if (hotplug_dry_run) {
+		info("dry run: load %s into %s", firmware_env, devpath);
+		if (src_fd == -1)
+			return 1;
+		close(src_fd);
+		return 0;
 	}
 
-	src_ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, src_fd, 0);
-	if (src_ptr == MAP_FAILED) {
-		dbg("mmap failed: %s", strerror(errno));
+	load_fd = fw_open("%s/loading", devpath, O_WRONLY);
+	if ((load_fd == -1) || (src_fd == -1))
+		goto err;
+	dst_fd = fw_open("%s/data", devpath, O_WRONLY);
+	if (dst_fd == -1)
 		goto err;
-	}
 
 	if (fw_write(load_fd, "1", 1) == -1)
 		goto err;
-	if (fw_write(dst_fd, src_ptr, st.st_size) == -1)
+	cache_fd = hotplug_firmware_cache_open(firmware_env, &st);
+	if (cache_fd != -1) {
+		/* cached decompressed */
+		if (fstat(cache_fd, &cache_st) == -1 ||
+		    firmware_upload(dst_fd, cache_fd, cache_st.st_size, 0, &method) == -1)
+			goto err;
+	} else if (format != FIRMWARE_PLAIN) {
+		if (firmware_decompress(dst_fd, src_fd, 0, format, 0) == -1)
+			goto err;
+	} else if (firmware_upload(dst_fd, src_fd, st.st_size, 0, &method) == -1) {
 		goto err;
+	}
 	if (fw_write(load_fd, "0", 1) == -1)
 		goto err;
+	hotplug_prefetch_record(HOTPLUG_PREFETCH_FIRMWARE, firmware_env);
+	if (cache_fd == -1)
+		hotplug_firmware_cache_add(firmware_env, src_fd, &st, format);
 
 	goto cleanup;
 err:
@@ -112,10 +426,10 @@ err:
 	if (load_fd != -1)
 		fw_write(load_fd, "-1", 2);
 cleanup:
-	if (src_ptr != MAP_FAILED)
-		munmap(src_ptr, st.st_size);
 	if (dst_fd != -1)
 		close(dst_fd);
+	if (cache_fd != -1)
+		close(cache_fd);
 	if (src_fd != -1)
 		close(src_fd);
 	if (load_fd != -1)
@@ -124,4 +438,43 @@ cleanup:
 	return ret;
 }
 
+void firmware_cancel(const char *devpath_env)
+{
+	char devpath[PATH_SIZE];
+	int load_fd;
+
+	sysfs_init();
+	strlcpy(devpath, sysfs_path, sizeof(devpath));
+	strlcat(devpath, devpath_env, sizeof(devpath));
 
+	load_fd = fw_open("%s/loading", devpath, O_WRONLY);
+	if (load_fd == -1)
+		return;
+	fw_write(load_fd, "-1", 2);
+	close(load_fd);
+}
+
+int firmware_add(void)
+{
+	char *devpath_env;
+	char *firmware_env;
+
+	devpath_env = getenv("DEVPATH");
+	firmware_env = getenv("FIRMWARE");
+	dbg("DEVPATH='%s', FIRMWARE = '%s'", devpath_env, firmware_env);
+	if ((devpath_env == NULL) ||
+	    (firmware_env == NULL)) {
+		dbg("missing an environment variable, aborting.");
+		return 1;
+	}
+
+#if defined(FIRMWARED)
+	/* firmwared holds the lock on its pidfile while it runs */
+	if (!hotplug_dry_run && pidfile_locked("firmwared")) {
+		dbg("firmwared handles the request");
+		return 0;
+	}
+#endif
+
+	return firmware_load(devpath_env, firmware_env);
+}
@@ -1,6 +1,49 @@
 #ifndef HOTPLUG_MODULE_FIRMWARE_H
 #define HOTPLUG_MODULE_FIRMWARE_H
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Searched in the firmware_class.path directory, then in updates/<release>,
+ * updates, <release> and the directory itself, like the kernel does.
+ */
+#define FIRMWARE_DIR		"/lib/firmware"
+
+/* bytes per system call, see firmwarebench */
+#ifndef FIRMWARE_CHUNK_SIZE
+#define FIRMWARE_CHUNK_SIZE	(64 * 1024)
+#endif
+
+enum firmware_upload {
+	FIRMWARE_UPLOAD_SENDFILE,
+	FIRMWARE_UPLOAD_MMAP,
+};
+
+/* <name>.gz and <name>.xz are found with -DUSE_ZLIB and -DUSE_LZMA */
+enum firmware_format {
+	FIRMWARE_PLAIN,
+	FIRMWARE_GZ,
+	FIRMWARE_XZ,
+};
+
+/* opens a regular file named name in the search path, fills in st */
+int firmware_open(const char *name, struct stat *st, enum firmware_format *format);
+/*
+ * Copies size bytes of src_fd to the current position of dst_fd in chunks
+ * of chunk bytes, or FIRMWARE_CHUNK_SIZE if 0. Falls back to mmap and
+ * write if sendfile is not supported, and updates method accordingly.
+ */
+int firmware_upload(int dst_fd, int src_fd, off_t size, size_t chunk, enum firmware_upload *method);
+/*
+ * Streams src_fd to dst_fd, decompressing chunk bytes at a time. Fails
+ * with EFBIG once more than max_size bytes are produced, unless it is 0.
+ */
+int firmware_decompress(int dst_fd, int src_fd, size_t chunk, enum firmware_format format,
+			off_t max_size);
+/* loads firmware_env into /sys$devpath_env, or cancels the request */
+int firmware_load(const char *devpath_env, const char *firmware_env);
+void firmware_cancel(const char *devpath_env);
 int firmware_add(void);
 
 #endif
@@ -23,18 +23,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include "hotplug_timeout.h"
 #include "hotplug_util.h"
 #include "module_scsi.h"
 #include "udev.h"
 
+#define SCSI_TYPE_TIMEOUT	10000
+#define SCSI_TYPE_CHECK		100
+
 int scsi_add(void)
 {
-	char scsi_file[256];
+	char scsi_file[PATH_SIZE];
 	char scsi_type[50];
+	struct hotplug_timer check = { .slot = 0 };
+	struct timeout t;
+	struct stat stats;
 	int type;
 	char *devpath;
 	char *module = NULL;
-	int i;
 	int fd;
 	int len;
 	int retval = 1;
@@ -45,13 +51,16 @@ int scsi_add(void)
 		goto exit;
 	}
 
-	snprintf(scsi_file, sizeof(scsi_file), "/sys%s/type", devpath);
-	for (i = 0; i < 10; ++i) {
-		struct stat stats;
-		if (stat(scsi_file, &stats) == 0)
-			break;
-		sleep(1);
-	}
+	sysfs_init();
+	strlcpy(scsi_file, sysfs_path, sizeof(scsi_file));
+	strlcat(scsi_file, devpath, sizeof(scsi_file));
+	strlcat(scsi_file, "/type", sizeof(scsi_file));
+	/* the attribute may show up after the event */
+	timeout_init(&t, SCSI_TYPE_TIMEOUT);
+	hotplug_timer_add(&check, SCSI_TYPE_CHECK, SCSI_TYPE_CHECK);
+	while (stat(scsi_file, &stats) != 0 && !timeout_exceeded(&t))
+		hotplug_timer_wait(-1, 0);
+	hotplug_timer_del(&check);
 	fd = open(scsi_file, O_RDONLY);
 	if (fd < 0) {
 		dbg("can't open file '%s'", scsi_file);
@@ -16,6 +16,7 @@
  *
  */
 
+#define _GNU_SOURCE	/* for recvmmsg() */
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,16 +29,40 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <linux/types.h>
 #include <linux/netlink.h>
 
+#include "hotplug_netlink.h"
+#include "hotplug_uevent.h"
 #include "udev.h"
 #include "udevd.h"
 
 static int uevent_netlink_sock = -1;
 static int udev_monitor_sock = -1;
 static volatile int udev_exit;
+static volatile int print_stats;
+static struct hotplug_netlink_stats netlink_stats;
+static struct hotplug_netlink_filter filter;
+static int print_env;
+
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_BINARY,
+};
+
+static enum output_format output = OUTPUT_TEXT;
+static FILE *record_file;
+
+/* stdout is flushed whenever all sockets are drained */
+#define MONITOR_OUTPUT_BUFFER	(64 * 1024)
+
+/* number of messages fetched with a single recvmmsg() */
+#define MONITOR_BATCH		16
+
+static char monitor_buf[MONITOR_BATCH][UEVENT_BUFFER_SIZE*2];
+static int have_recvmmsg = 1;
 
 static int init_udev_monitor_socket(void)
 {
@@ -69,86 +94,236 @@ static int init_udev_monitor_socket(void)
 	return 0;
 }
 
-static int init_uevent_netlink_sock(void)
+static void asmlinkage sig_handler(int signum)
 {
-	struct sockaddr_nl snl;
-	int retval;
-
-	memset(&snl, 0x00, sizeof(struct sockaddr_nl));
-	snl.nl_family = AF_NETLINK;
-	snl.nl_pid = getpid();
-	snl.nl_groups = 1;
+	if (signum == SIGINT || signum == SIGTERM)
+		udev_exit = 1;
+	else if (signum == SIGUSR1)
+		print_stats = 1;
+}
 
-	uevent_netlink_sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
-	if (uevent_netlink_sock == -1) {
-		fprintf(stderr, "error getting socket: %s\n", strerror(errno));
-		return -1;
+static void print_json_string(const char *str)
+{
+	putchar('"');
+	for (; str[0] != '\0'; str++) {
+		unsigned char c = str[0];
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
 	}
+	putchar('"');
+}
 
-	retval = bind(uevent_netlink_sock, (struct sockaddr *) &snl,
-		      sizeof(struct sockaddr_nl));
-	if (retval < 0) {
-		fprintf(stderr, "bind failed: %s\n", strerror(errno));
-		close(uevent_netlink_sock);
-		uevent_netlink_sock = -1;
-		return -1;
+static void print_json_key(const char *key, const char *value)
+{
+	print_json_string(key);
+	putchar(':');
+	if (value != NULL)
+		print_json_string(value);
+	else
+		fputs("null", stdout);
+}
+
+static void print_event_json(enum uevent_record_source source, const char *timestr, const struct uevent *ev)
+{
+	const struct uevent_var *var;
+	unsigned int i;
+
+	putchar('{');
+	print_json_key("source", (source == UEVENT_RECORD_KERNEL) ? "kernel" : "udev");
+	putchar(',');
+	print_json_key("timestamp", timestr);
+	putchar(',');
+	print_json_key("action", ev->known[UEVENT_ACTION]);
+	putchar(',');
+	print_json_key("devpath", ev->known[UEVENT_DEVPATH]);
+	putchar(',');
+	print_json_key("subsystem", ev->known[UEVENT_SUBSYSTEM]);
+	fputs(",\"env\":{", stdout);
+	for (i = 0; i < ev->count; i++) {
+		var = &ev->vars[i];
+		if (i > 0)
+			putchar(',');
+		/* keys are not terminated, values are */
+		putchar('"');
+		fwrite(var->key, var->keylen, 1, stdout);
+		fputs("\":", stdout);
+		print_json_string(var->value);
 	}
+	fputs("}}\n", stdout);
+}
 
-	return 0;
+static void write_record(FILE *f, enum uevent_record_source source, const struct timeval *tv,
+			 const char *buf, size_t buflen)
+{
+	struct uevent_record record;
+
+	record.size = buflen;
+	record.source = source;
+	record.usec = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+	fwrite(&record, sizeof(record), 1, f);
+	fwrite(buf, buflen, 1, f);
 }
 
-static void asmlinkage sig_handler(int signum)
+static void print_event(enum uevent_record_source source, const struct timeval *tv,
+			const char *buf, size_t buflen, const struct uevent *ev)
 {
-	if (signum == SIGINT || signum == SIGTERM)
-		udev_exit = 1;
+	const char *devpath = ev->known[UEVENT_DEVPATH];
+	const char *action = ev->known[UEVENT_ACTION];
+	const char *subsys = ev->known[UEVENT_SUBSYSTEM];
+	char timestr[64];
+	unsigned int i;
+
+	if (!hotplug_netlink_filter_match(&filter, action, devpath, subsys))
+		return;
+
+	if (record_file != NULL)
+		write_record(record_file, source, tv, buf, buflen);
+
+	if (output == OUTPUT_BINARY) {
+		write_record(stdout, source, tv, buf, buflen);
+		return;
+	}
+
+	snprintf(timestr, sizeof(timestr), "%llu.%06u",
+		 (unsigned long long) tv->tv_sec, (unsigned int) tv->tv_usec);
+
+	if (output == OUTPUT_JSON) {
+		print_event_json(source, timestr, ev);
+		return;
+	}
+
+	printf("%s[%s] %-8s %s (%s)\n",
+	       (source == UEVENT_RECORD_KERNEL) ? "UEVENT" : "UDEV  ",
+	       timestr, action, devpath, subsys);
+
+	/* print environment */
+	if (print_env) {
+		for (i = 0; i < ev->count; i++)
+			printf("%s\n", ev->vars[i].key);
+		printf("\n");
+	}
 }
 
-static const char *search_key(const char *searchkey, const char *buf, size_t buflen)
+static int receive_batch(int sock, struct mmsghdr *msgs, struct iovec *iov)
 {
-	size_t bufpos = 0;
-	size_t searchkeylen = strlen(searchkey);
+	unsigned int i;
+	ssize_t buflen;
+
+	for (i = 0; i < MONITOR_BATCH; i++) {
+		iov[i].iov_base = monitor_buf[i];
+		iov[i].iov_len = sizeof(monitor_buf[i]) - 1;
+		memset(&msgs[i].msg_hdr, 0x00, sizeof(struct msghdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (have_recvmmsg) {
+		int count = recvmmsg(sock, msgs, MONITOR_BATCH, MSG_DONTWAIT, NULL);
+		if (count >= 0 || errno != ENOSYS)
+			return count;
+		have_recvmmsg = 0;
+	}
+
+	buflen = recv(sock, monitor_buf[0], sizeof(monitor_buf[0]) - 1, MSG_DONTWAIT);
+	if (buflen < 0)
+		return -1;
+	msgs[0].msg_len = buflen;
+	return 1;
+}
 
-	while (bufpos < buflen) {
-		const char *key;
-		int keylen;
+/*
+ * The sockets are edge triggered, read until the queue is empty. After an
+ * error the socket is rearmed, so what is still queued brings it back.
+ */
+static void drain_socket(int epoll_fd, int sock, enum uevent_record_source source)
+{
+	struct epoll_event rearm;
+	struct mmsghdr msgs[MONITOR_BATCH];
+	struct iovec iov[MONITOR_BATCH];
+	struct uevent ev;
+	struct timeval tv;
+	int count;
+	int i;
 
-		key = &buf[bufpos];
-		keylen = strlen(key);
-		if (keylen == 0)
+	while (!udev_exit) {
+		count = receive_batch(sock, msgs, iov);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "error receiving %s message: %s\n",
+				(sock == uevent_netlink_sock) ? "uevent" : "udev", strerror(errno));
+			/* the overflow is reported once, the queue still holds the newer messages */
+			if (errno == ENOBUFS) {
+				if (sock == uevent_netlink_sock)
+					hotplug_netlink_enobufs(&netlink_stats);
+				continue;
+			}
+			memset(&rearm, 0x00, sizeof(rearm));
+			rearm.events = EPOLLIN | EPOLLET;
+			rearm.data.fd = sock;
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &rearm);
 			break;
-		 if ((strncmp(searchkey, key, searchkeylen) == 0) && key[searchkeylen] == '=')
-			return &key[searchkeylen + 1];
-		bufpos += keylen + 1;
+		}
+
+		if (gettimeofday(&tv, NULL) != 0)
+			memset(&tv, 0x00, sizeof(tv));
+
+		for (i = 0; i < count; i++) {
+			if (msgs[i].msg_len == 0)
+				continue;
+			monitor_buf[i][msgs[i].msg_len] = '\0';
+			if (uevent_parse(&ev, monitor_buf[i], msgs[i].msg_len + 1) != 0)
+				continue;
+			if (sock == uevent_netlink_sock)
+				hotplug_netlink_account(&netlink_stats, ev.known[UEVENT_SEQNUM]);
+			print_event(source, &tv, monitor_buf[i], msgs[i].msg_len, &ev);
+		}
 	}
-	return NULL;
 }
 
 int udevmonitor(int argc, char *argv[], char *envp[])
 {
 	struct sigaction act;
 	int option;
-	int env = 0;
 	int kernel = 0;
 	int udev = 0;
-	fd_set readfds;
+	int rcvbuf = HOTPLUG_NETLINK_RCVBUF;
+	int epoll_fd = -1;
+	struct epoll_event ev;
 	int retval = 0;
 
 	static const struct option options[] = {
 		{ "environment", 0, NULL, 'e' },
 		{ "kernel", 0, NULL, 'k' },
 		{ "udev", 0, NULL, 'u' },
+		{ "buffer-size", 1, NULL, 'b' },
+		{ "subsystem-match", 1, NULL, 's' },
+		{ "action-match", 1, NULL, 'a' },
+		{ "devpath-match", 1, NULL, 'p' },
+		{ "json", 0, NULL, 'j' },
+		{ "binary", 0, NULL, 'B' },
+		{ "record", 1, NULL, 'r' },
 		{ "help", 0, NULL, 'h' },
 		{ NULL, 0, NULL, 0 },
 	};
 
+	hotplug_netlink_filter_init(&filter);
+
 	while (1) {
-		option = getopt_long(argc, argv, "ekuh", options, NULL);
+		option = getopt_long(argc, argv, "ekub:s:a:p:jBr:h", options, NULL);
 		if (option == -1)
 			break;
 
 		switch (option) {
 		case 'e':
-			env = 1;
+			print_env = 1;
 			break;
 		case 'k':
 			kernel = 1;
@@ -156,12 +331,51 @@ int udevmonitor(int argc, char *argv[], char *envp[])
 		case 'u':
 			udev = 1;
 			break;
+		case 'b':
+			rcvbuf = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			name_list_add(&filter.subsystem_list, optarg, 0);
+			break;
+		case 'a':
+			name_list_add(&filter.action_list, optarg, 0);
+			break;
+		case 'p':
+			name_list_add(&filter.devpath_list, optarg, 0);
+			break;
+		case 'j':
+			output = OUTPUT_JSON;
+			break;
+		case 'B':
+			output = OUTPUT_BINARY;
+			break;
+		case 'r':
+			record_file = fopen(optarg, "w");
+			if (record_file == NULL) {
+				fprintf(stderr, "unable to open '%s': %s\n", optarg, strerror(errno));
+				retval = 1;
+				goto out;
+			}
+			setvbuf(record_file, NULL, _IOFBF, MONITOR_OUTPUT_BUFFER);
+			break;
 		case 'h':
-			printf("Usage: udevadm monitor [--environment] [--kernel] [--udev] [--help]\n"
-			       "  --env    print the whole event environment\n"
-			       "  --kernel print kernel uevents\n"
-			       "  --udev   print udev events\n"
-			       "  --help   print this help text\n\n");
+			printf("Usage: udevadm monitor [--environment] [--kernel] [--udev] [--buffer-size=<bytes>]\n"
+			       "                      [--subsystem-match=<subsystem>] [--action-match=<action>]\n"
+			       "                      [--devpath-match=<prefix>] [--json|--binary]\n"
+			       "                      [--record=<file>] [--help]\n"
+			       "  --env             print the whole event environment\n"
+			       "  --kernel          print kernel uevents\n"
+			       "  --udev            print udev events\n"
+			       "  --buffer-size     kernel uevent receive buffer size\n"
+			       "  --subsystem-match print only events of the subsystem\n"
+			       "  --action-match    print only events with the action\n"
+			       "  --devpath-match   print only events with a devpath starting with prefix\n"
+			       "  --json            print one JSON object per event\n"
+			       "  --binary          write length prefixed binary records of the raw events\n"
+			       "  --record=<file>   additionally store the binary records in file, for ueventreplay\n"
+			       "  --help            print this help text\n\n"
+			       "Kernel uevents which do not match are dropped by a socket filter.\n"
+			       "SIGUSR1 prints the kernel uevent receive statistics.\n\n");
 		default:
 			goto out;
 		}
@@ -184,104 +398,89 @@ int udevmonitor(int argc, char *argv[], char *envp[])
 	act.sa_flags = SA_RESTART;
 	sigaction(SIGINT, &act, NULL);
 	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGUSR1, &act, NULL);
 
-	printf("udevmonitor will print the received events for:\n");
+	setvbuf(stdout, NULL, _IOFBF, MONITOR_OUTPUT_BUFFER);
+	if (output == OUTPUT_TEXT)
+		printf("udevmonitor will print the received events for:\n");
 	if (udev) {
 		retval = init_udev_monitor_socket();
 		if (retval)
 			goto out;
-		printf("UDEV the event which udev sends out after rule processing\n");
+		if (output == OUTPUT_TEXT)
+			printf("UDEV the event which udev sends out after rule processing\n");
 	}
 	if (kernel) {
-		retval = init_uevent_netlink_sock();
-		if (retval)
+		uevent_netlink_sock = hotplug_netlink_open(rcvbuf, &netlink_stats);
+		if (uevent_netlink_sock < 0) {
+			retval = -1;
 			goto out;
-		printf("UEVENT the kernel uevent\n");
+		}
+		hotplug_netlink_filter_attach(uevent_netlink_sock, &filter, &netlink_stats);
+		if (output == OUTPUT_TEXT)
+			printf("UEVENT the kernel uevent\n");
+	}
+	if (output == OUTPUT_TEXT)
+		printf("\n");
+
+	epoll_fd = epoll_create(2);
+	if (epoll_fd < 0) {
+		fprintf(stderr, "error creating epoll fd: %s\n", strerror(errno));
+		retval = -1;
+		goto out;
+	}
+	memset(&ev, 0x00, sizeof(struct epoll_event));
+	ev.events = EPOLLIN | EPOLLET;
+	if (uevent_netlink_sock >= 0) {
+		ev.data.fd = uevent_netlink_sock;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uevent_netlink_sock, &ev);
+	}
+	if (udev_monitor_sock >= 0) {
+		ev.data.fd = udev_monitor_sock;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udev_monitor_sock, &ev);
 	}
-	printf("\n");
 
 	while (!udev_exit) {
-		char buf[UEVENT_BUFFER_SIZE*2];
-		ssize_t buflen;
-		ssize_t bufpos;
-		ssize_t keys;
+		struct epoll_event events[2];
 		int fdcount;
-		struct timeval tv;
-		struct timezone tz;
-		char timestr[64];
-		const char *source = NULL;
-		const char *devpath, *action, *subsys;
-
-		buflen = 0;
-		FD_ZERO(&readfds);
-		if (uevent_netlink_sock >= 0)
-			FD_SET(uevent_netlink_sock, &readfds);
-		if (udev_monitor_sock >= 0)
-			FD_SET(udev_monitor_sock, &readfds);
-
-		fdcount = select(UDEV_MAX(uevent_netlink_sock, udev_monitor_sock)+1, &readfds, NULL, NULL, NULL);
+		int i;
+
+		if (print_stats) {
+			print_stats = 0;
+			hotplug_netlink_print_stats(&netlink_stats);
+		}
+
+		/* nothing pending, flush before going to sleep */
+		fflush(stdout);
+		if (record_file != NULL)
+			fflush(record_file);
+		fdcount = epoll_wait(epoll_fd, events, 2, -1);
 		if (fdcount < 0) {
 			if (errno != EINTR)
 				fprintf(stderr, "error receiving uevent message: %s\n", strerror(errno));
 			continue;
 		}
 
-		if (gettimeofday(&tv, &tz) == 0) {
-			snprintf(timestr, sizeof(timestr), "%llu.%06u",
-				 (unsigned long long) tv.tv_sec, (unsigned int) tv.tv_usec);
-		} else
-			timestr[0] = '\0';
-
-		if ((uevent_netlink_sock >= 0) && FD_ISSET(uevent_netlink_sock, &readfds)) {
-			buflen = recv(uevent_netlink_sock, &buf, sizeof(buf), 0);
-			if (buflen <= 0) {
-				fprintf(stderr, "error receiving uevent message: %s\n", strerror(errno));
-				continue;
-			}
-			source = "UEVENT";
-		}
-
-		if ((udev_monitor_sock >= 0) && FD_ISSET(udev_monitor_sock, &readfds)) {
-			buflen = recv(udev_monitor_sock, &buf, sizeof(buf), 0);
-			if (buflen <= 0) {
-				fprintf(stderr, "error receiving udev message: %s\n", strerror(errno));
-				continue;
-			}
-			source = "UDEV  ";
-		}
-
-		if (buflen == 0)
-			continue;
-
-		keys = strlen(buf) + 1; /* start of payload */
-		devpath = search_key("DEVPATH", &buf[keys], buflen);
-		action = search_key("ACTION", &buf[keys], buflen);
-		subsys = search_key("SUBSYSTEM", &buf[keys], buflen);
-		printf("%s[%s] %-8s %s (%s)\n", source, timestr, action, devpath, subsys);
-
-		/* print environment */
-		bufpos = keys;
-		if (env) {
-			while (bufpos < buflen) {
-				int keylen;
-				char *key;
-
-				key = &buf[bufpos];
-				keylen = strlen(key);
-				if (keylen == 0)
-					break;
-				printf("%s\n", key);
-				bufpos += keylen + 1;
-			}
-			printf("\n");
+		for (i = 0; i < fdcount; i++) {
+			if (events[i].data.fd == uevent_netlink_sock)
+				drain_socket(epoll_fd, uevent_netlink_sock, UEVENT_RECORD_KERNEL);
+			else if (events[i].data.fd == udev_monitor_sock)
+				drain_socket(epoll_fd, udev_monitor_sock, UEVENT_RECORD_UDEV);
 		}
 	}
 
 out:
-	if (uevent_netlink_sock >= 0)
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	if (uevent_netlink_sock >= 0) {
+		hotplug_netlink_print_stats(&netlink_stats);
 		close(uevent_netlink_sock);
+	}
+	hotplug_netlink_filter_cleanup(&filter);
 	if (udev_monitor_sock >= 0)
 		close(udev_monitor_sock);
+	if (record_file != NULL)
+		fclose(record_file);
 
 	if (retval)
 		return 1;
@@ -30,32 +30,100 @@
 #include <fnmatch.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 
 #include "udev.h"
 #include "udevd.h"
 
 static int verbose;
 static int dry_run;
+static int jobs = 1;
 LIST_HEAD(device_list);
 LIST_HEAD(filter_subsystem_match_list);
 LIST_HEAD(filter_subsystem_nomatch_list);
 LIST_HEAD(filter_attr_match_list);
 LIST_HEAD(filter_attr_nomatch_list);
 
-/* devices that should run last cause of their dependencies */
-static int delay_device(const char *devpath)
+/* parents are never deeper than this below their children */
+#define DEPTH_MAX_LEVEL		16
+
+static int device_depth(const char *devpath, int level);
+
+/* depth of the device a "device" or slave link points to */
+static int link_depth(const char *devpath, const char *link, int level)
 {
-	static const char *delay_device_list[] = {
-		"*/md*",
-		"*/dm-*",
-		NULL
-	};
-	int i;
+	char target[PATH_SIZE];
 
-	for (i = 0; delay_device_list[i] != NULL; i++)
-		if (fnmatch(delay_device_list[i], devpath, 0) == 0)
-			return 1;
-	return 0;
+	strlcpy(target, devpath, sizeof(target));
+	strlcat(target, "/", sizeof(target));
+	strlcat(target, link, sizeof(target));
+	if (sysfs_resolve_link(target, sizeof(target)) != 0)
+		return -1;
+
+	return device_depth(target, level + 1);
+}
+
+/*
+ * Position of a device in the sysfs topology: every device is deeper
+ * than its parent, and md/dm devices are deeper than their slaves.
+ * Below /devices the parent is always a prefix of the devpath, so the
+ * number of path elements is enough, all other devices are linked to
+ * their parent with the "device" link.
+ */
+static int device_depth(const char *devpath, int level)
+{
+	char path[PATH_SIZE];
+	const char *pos;
+	DIR *dir;
+	struct dirent *dent;
+	int depth = 0;
+	int d;
+
+	if (level > DEPTH_MAX_LEVEL)
+		return 0;
+
+	if (strncmp(devpath, "/devices/", 9) == 0) {
+		for (pos = devpath; pos[0] != '\0'; pos++)
+			if (pos[0] == '/')
+				depth++;
+	} else {
+		/* partitions below /block/<disk> and the like */
+		pos = strrchr(devpath, '/');
+		if (pos != NULL && pos != devpath) {
+			strlcpy(path, devpath, sizeof(path));
+			path[pos - devpath] = '\0';
+			if (strchr(&path[1], '/') != NULL)
+				depth = device_depth(path, level + 1) + 1;
+		}
+
+		d = link_depth(devpath, "device", level);
+		if (d >= depth)
+			depth = d + 1;
+	}
+
+	/* md, dm and loop devices depend on their slaves */
+	if (strstr(devpath, "/block/") == NULL)
+		return depth;
+
+	strlcpy(path, sysfs_path, sizeof(path));
+	strlcat(path, devpath, sizeof(path));
+	strlcat(path, "/slaves", sizeof(path));
+	dir = opendir(path);
+	if (dir == NULL)
+		return depth;
+	for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
+		if (dent->d_name[0] == '.')
+			continue;
+		strlcpy(path, "slaves/", sizeof(path));
+		strlcat(path, dent->d_name, sizeof(path));
+		d = link_depth(devpath, path, level);
+		if (d >= depth)
+			depth = d + 1;
+	}
+	closedir(dir);
+
+	return depth;
 }
 
 static int device_list_insert(const char *path)
@@ -114,41 +182,475 @@ static void trigger_uevent(const char *devpath, const char *action)
 	close(fd);
 }
 
+struct trigger_entry {
+	const char *devpath;
+	int depth;
+};
+
+static int trigger_entry_cmp(const void *a, const void *b)
+{
+	const struct trigger_entry *entry_a = a;
+	const struct trigger_entry *entry_b = b;
+
+	if (entry_a->depth != entry_b->depth)
+		return entry_a->depth - entry_b->depth;
+	return strcmp(entry_a->devpath, entry_b->devpath);
+}
+
+/* devices of the same depth never depend on each other */
+static void trigger_level(const struct trigger_entry *entries, int count, const char *action)
+{
+	pid_t pid;
+	int workers;
+	int i, j;
+
+	workers = (jobs < count) ? jobs : count;
+	if (workers <= 1) {
+		for (i = 0; i < count; i++)
+			trigger_uevent(entries[i].devpath, action);
+		return;
+	}
+
+	fflush(stdout);
+	for (i = 0; i < workers; i++) {
+		pid = fork();
+		if (pid == 0) {
+			for (j = i; j < count; j += workers)
+				trigger_uevent(entries[j].devpath, action);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (pid == -1) {
+			dbg("fork failed: %s", strerror(errno));
+			for (j = i; j < count; j += workers)
+				trigger_uevent(entries[j].devpath, action);
+		}
+	}
+
+	while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+		;
+}
+
+/*
+ * Coldplug snapshot: the devpath, modalias and driver of every device
+ * seen by the last run, stored as a header followed by "count" records
+ * of three NUL terminated strings, sorted by devpath. Devices which
+ * still have the same driver bound to the same modalias do not need
+ * another event. It is saved by a separate --snapshot-save run at the end
+ * of boot, when the coldplug events have loaded their modules.
+ */
+#define SNAPSHOT_MAGIC		"HPSN"
+#define SNAPSHOT_VERSION	1
+
+struct snapshot_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	char release[65];
+};
+
+struct device_state {
+	const char *devpath;
+	const char *modalias;
+	const char *driver;
+};
+
+static const char *snapshot_file;
+/* record the settled devices instead of triggering them */
+static int snapshot_save_only;
+static char *snapshot_buf;
+static struct device_state *snapshot;
+static int snapshot_count;
+
+/* devices to store in the next snapshot */
+static char **seen_list;
+static int seen_count;
+static int seen_size;
+
+static int device_state_cmp(const void *a, const void *b)
+{
+	const struct device_state *state_a = a;
+	const struct device_state *state_b = b;
+
+	return strcmp(state_a->devpath, state_b->devpath);
+}
+
+static void device_state_read(const char *devpath, char *modalias, char *driver)
+{
+	char path[PATH_SIZE];
+	char target[PATH_SIZE];
+	char *pos;
+	size_t len;
+	ssize_t size;
+	int fd;
+
+	len = strlcpy(path, sysfs_path, sizeof(path));
+	len += strlcpy(&path[len], devpath, sizeof(path) - len);
+
+	modalias[0] = '\0';
+	strlcpy(&path[len], "/modalias", sizeof(path) - len);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		size = read(fd, modalias, NAME_SIZE - 1);
+		close(fd);
+		if (size < 0)
+			size = 0;
+		modalias[size] = '\0';
+		remove_trailing_chars(modalias, '\n');
+	}
+
+	driver[0] = '\0';
+	strlcpy(&path[len], "/driver", sizeof(path) - len);
+	size = readlink(path, target, sizeof(target) - 1);
+	if (size > 0) {
+		target[size] = '\0';
+		pos = strrchr(target, '/');
+		strlcpy(driver, (pos != NULL) ? &pos[1] : target, NAME_SIZE);
+	}
+}
+
+static int snapshot_load(const char *filename)
+{
+	const struct snapshot_header *header;
+	struct utsname uts;
+	struct stat statbuf;
+	struct stat depbuf;
+	char path[PATH_SIZE];
+	size_t pos;
+	ssize_t size;
+	uint32_t i;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		info("no snapshot '%s', trigger all devices", filename);
+		return -1;
+	}
+	if (fstat(fd, &statbuf) != 0 || (size_t)statbuf.st_size <= sizeof(struct snapshot_header))
+		goto stale;
+
+	/* a new kernel or new modules may bind other drivers */
+	uname(&uts);
+	snprintf(path, sizeof(path), "/lib/modules/%s/modules.dep", uts.release);
+	if (stat(path, &depbuf) == 0 && depbuf.st_mtime >= statbuf.st_mtime)
+		goto stale;
+
+	snapshot_buf = malloc(statbuf.st_size);
+	if (snapshot_buf == NULL)
+		goto stale;
+	size = read(fd, snapshot_buf, statbuf.st_size);
+	if (size != statbuf.st_size || snapshot_buf[size - 1] != '\0')
+		goto stale;
+
+	header = (const struct snapshot_header *)snapshot_buf;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 ||
+	    header->version != SNAPSHOT_VERSION ||
+	    strncmp(header->release, uts.release, sizeof(header->release)) != 0)
+		goto stale;
+
+	/* each device takes at least the three terminating NULs */
+	if (header->count > ((size_t)size - sizeof(struct snapshot_header)) / 3)
+		goto stale;
+	snapshot = calloc(header->count, sizeof(struct device_state));
+	if (snapshot == NULL)
+		goto stale;
+
+	pos = sizeof(struct snapshot_header);
+	for (i = 0; i < header->count; i++) {
+		const char **field[] = { &snapshot[i].devpath, &snapshot[i].modalias, &snapshot[i].driver };
+		unsigned int f;
+
+		for (f = 0; f < 3; f++) {
+			if (pos >= (size_t)size)
+				goto stale;
+			*field[f] = &snapshot_buf[pos];
+			pos += strlen(&snapshot_buf[pos]) + 1;
+		}
+	}
+	snapshot_count = header->count;
+	qsort(snapshot, snapshot_count, sizeof(struct device_state), device_state_cmp);
+
+	close(fd);
+	dbg("loaded %i devices from snapshot '%s'", snapshot_count, filename);
+	return 0;
+
+stale:
+	info("snapshot '%s' is stale, trigger all devices", filename);
+	free(snapshot);
+	snapshot = NULL;
+	free(snapshot_buf);
+	snapshot_buf = NULL;
+	close(fd);
+	return -1;
+}
+
+static void snapshot_seen(const char *devpath)
+{
+	char **list;
+	char *name;
+
+	if (seen_count == seen_size) {
+		list = realloc(seen_list, (seen_size + 256) * sizeof(char *));
+		if (list == NULL)
+			return;
+		seen_list = list;
+		seen_size += 256;
+	}
+
+	name = strdup(devpath);
+	if (name != NULL)
+		seen_list[seen_count++] = name;
+}
+
+/* skip devices which are bound to the same driver as in the last run */
+static int snapshot_unchanged(const char *devpath)
+{
+	struct device_state key;
+	const struct device_state *state;
+	char modalias[NAME_SIZE];
+	char driver[NAME_SIZE];
+
+	if (snapshot == NULL)
+		return 0;
+
+	key.devpath = devpath;
+	state = bsearch(&key, snapshot, snapshot_count, sizeof(struct device_state), device_state_cmp);
+	if (state == NULL)
+		return 0;
+
+	device_state_read(devpath, modalias, driver);
+	if (driver[0] == '\0')
+		return 0;
+
+	return strcmp(state->driver, driver) == 0 && strcmp(state->modalias, modalias) == 0;
+}
+
+static int seen_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void snapshot_save(const char *filename)
+{
+	struct snapshot_header header;
+	struct utsname uts;
+	char filename_tmp[PATH_SIZE];
+	char modalias[NAME_SIZE];
+	char driver[NAME_SIZE];
+	FILE *f;
+	int i;
+
+	qsort(seen_list, seen_count, sizeof(char *), seen_cmp);
+
+	memset(&header, 0x00, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+	header.version = SNAPSHOT_VERSION;
+	for (i = 0; i < seen_count; i++)
+		if (i == 0 || strcmp(seen_list[i - 1], seen_list[i]) != 0)
+			header.count++;
+	uname(&uts);
+	strlcpy(header.release, uts.release, sizeof(header.release));
+
+	strlcpy(filename_tmp, filename, sizeof(filename_tmp));
+	strlcat(filename_tmp, ".tmp", sizeof(filename_tmp));
+	f = fopen(filename_tmp, "w");
+	if (f == NULL) {
+		err("unable to create '%s': %s", filename_tmp, strerror(errno));
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+	for (i = 0; i < seen_count; i++) {
+		if (i > 0 && strcmp(seen_list[i - 1], seen_list[i]) == 0)
+			continue;
+		device_state_read(seen_list[i], modalias, driver);
+		fwrite(seen_list[i], strlen(seen_list[i]) + 1, 1, f);
+		fwrite(modalias, strlen(modalias) + 1, 1, f);
+		fwrite(driver, strlen(driver) + 1, 1, f);
+	}
+
+	if (fclose(f) != 0 || rename(filename_tmp, filename) != 0) {
+		err("unable to write '%s': %s", filename, strerror(errno));
+		unlink(filename_tmp);
+	}
+}
+
+static void snapshot_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < seen_count; i++)
+		free(seen_list[i]);
+	free(seen_list);
+	free(snapshot);
+	free(snapshot_buf);
+}
+
 static void exec_list(const char *action)
 {
 	struct name_entry *loop_device;
 	struct name_entry *tmp_device;
+	struct trigger_entry *entries;
+	int count = 0;
+	int start, end;
+
+	list_for_each_entry(loop_device, &device_list, node)
+		count++;
+
+	entries = malloc(count * sizeof(struct trigger_entry));
+	if (entries == NULL) {
+		/* no memory to sort, trigger in plain order */
+		list_for_each_entry(loop_device, &device_list, node)
+			trigger_uevent(loop_device->name, action);
+		goto out;
+	}
 
-	list_for_each_entry_safe(loop_device, tmp_device, &device_list, node) {
-		if (delay_device(loop_device->name))
+	count = 0;
+	list_for_each_entry(loop_device, &device_list, node) {
+		if (snapshot_save_only) {
+			snapshot_seen(loop_device->name);
 			continue;
-
-		trigger_uevent(loop_device->name, action);
-		list_del(&loop_device->node);
-		free(loop_device);
+		}
+		if (snapshot_unchanged(loop_device->name)) {
+			dbg("'%s' is unchanged", loop_device->name);
+			continue;
+		}
+		entries[count].devpath = loop_device->name;
+		entries[count].depth = device_depth(loop_device->name, 0);
+		dbg("'%s' depth %i", entries[count].devpath, entries[count].depth);
+		count++;
+	}
+	qsort(entries, count, sizeof(struct trigger_entry), trigger_entry_cmp);
+
+	/* parents first, all subtrees interleaved level by level */
+	for (start = 0; start < count; start = end) {
+		for (end = start + 1; end < count; end++)
+			if (entries[end].depth != entries[start].depth)
+				break;
+		trigger_level(&entries[start], end - start, action);
 	}
+	free(entries);
 
-	/* trigger remaining delayed devices */
+out:
 	list_for_each_entry_safe(loop_device, tmp_device, &device_list, node) {
-		trigger_uevent(loop_device->name, action);
 		list_del(&loop_device->node);
 		free(loop_device);
 	}
 }
 
+/* a --subsystem-match or --attr-match argument, parsed once at startup */
+struct trigger_filter {
+	struct list_head node;
+	const char *value;		/* attribute value, NULL to match existence */
+	int key_glob;			/* subsystem name contains wildcards */
+	int value_glob;			/* attribute value contains wildcards */
+	int attr;			/* slot in the attribute snapshot */
+	char key[];
+};
+
+enum attr_state {
+	ATTR_UNKNOWN,
+	ATTR_MISSING,
+	ATTR_EXISTS,			/* exists, but value is not read or not readable */
+	ATTR_VALUE,
+};
+
+/* attributes of the current device, every attribute is read only once */
+struct attr_value {
+	const char *name;
+	enum attr_state state;
+	char value[NAME_SIZE];
+};
+
+static struct attr_value *attr_snapshot;
+static int attr_count;
+
+/* a backslash escapes for fnmatch, such patterns can't be compared as strings */
+static int is_glob(const char *pattern)
+{
+	return strpbrk(pattern, "*?[\\") != NULL;
+}
+
+static int attr_slot(const char *name)
+{
+	struct attr_value *snapshot;
+	int i;
+
+	for (i = 0; i < attr_count; i++)
+		if (strcmp(attr_snapshot[i].name, name) == 0)
+			return i;
+
+	snapshot = realloc(attr_snapshot, (attr_count + 1) * sizeof(struct attr_value));
+	if (snapshot == NULL)
+		return -1;
+	attr_snapshot = snapshot;
+	attr_snapshot[attr_count].name = name;
+	attr_snapshot[attr_count].state = ATTR_UNKNOWN;
+	return attr_count++;
+}
+
+static int filter_add(struct list_head *filter_list, const char *arg, int attr)
+{
+	struct trigger_filter *filter;
+	char *pos;
+
+	filter = malloc(sizeof(struct trigger_filter) + strlen(arg) + 1);
+	if (filter == NULL)
+		return -1;
+	memset(filter, 0x00, sizeof(struct trigger_filter));
+	strcpy(filter->key, arg);
+
+	if (attr) {
+		/* separate attr and match value */
+		pos = strchr(filter->key, '=');
+		if (pos != NULL) {
+			pos[0] = '\0';
+			filter->value = &pos[1];
+			filter->value_glob = is_glob(filter->value);
+		}
+		filter->attr = attr_slot(filter->key);
+		if (filter->attr < 0) {
+			free(filter);
+			return -1;
+		}
+	} else
+		filter->key_glob = is_glob(filter->key);
+
+	list_add_tail(&filter->node, filter_list);
+	return 0;
+}
+
+static void filter_cleanup(struct list_head *filter_list)
+{
+	struct trigger_filter *loop_filter;
+	struct trigger_filter *tmp_filter;
+
+	list_for_each_entry_safe(loop_filter, tmp_filter, filter_list, node) {
+		list_del(&loop_filter->node);
+		free(loop_filter);
+	}
+}
+
+static int pattern_match(const char *pattern, int glob, const char *str)
+{
+	if (glob)
+		return fnmatch(pattern, str, 0) == 0;
+	return strcmp(pattern, str) == 0;
+}
+
 static int subsystem_filtered(const char *subsystem)
 {
-	struct name_entry *loop_name;
+	struct trigger_filter *loop_filter;
 
 	/* skip devices matching the listed subsystems */
-	list_for_each_entry(loop_name, &filter_subsystem_nomatch_list, node)
-		if (fnmatch(loop_name->name, subsystem, 0) == 0)
+	list_for_each_entry(loop_filter, &filter_subsystem_nomatch_list, node)
+		if (pattern_match(loop_filter->key, loop_filter->key_glob, subsystem))
 			return 1;
 
 	/* skip devices not matching the listed subsystems */
 	if (!list_empty(&filter_subsystem_match_list)) {
-		list_for_each_entry(loop_name, &filter_subsystem_match_list, node)
-			if (fnmatch(loop_name->name, subsystem, 0) == 0)
+		list_for_each_entry(loop_filter, &filter_subsystem_match_list, node)
+			if (pattern_match(loop_filter->key, loop_filter->key_glob, subsystem))
 				return 0;
 		return 1;
 	}
@@ -156,71 +658,91 @@ static int subsystem_filtered(const char *subsystem)
 	return 0;
 }
 
-static int attr_match(const char *path, const char *attr_value)
+/* fill in an attribute of the device opened as dirfd */
+static struct attr_value *attr_get(int dirfd, int slot, int need_value)
 {
-	char attr[NAME_SIZE];
-	char file[PATH_SIZE];
-	char *match_value;
+	struct attr_value *attr = &attr_snapshot[slot];
+	struct stat statbuf;
+	ssize_t size;
+	int fd;
 
-	strlcpy(attr, attr_value, sizeof(attr));
+	if (attr->state == ATTR_MISSING || attr->state == ATTR_VALUE)
+		return attr;
+	if (attr->state == ATTR_EXISTS && !need_value)
+		return attr;
 
-	/* separate attr and match value */
-	match_value = strchr(attr, '=');
-	if (match_value != NULL) {
-		match_value[0] = '\0';
-		match_value = &match_value[1];
+	if (!need_value) {
+		attr->state = (fstatat(dirfd, attr->name, &statbuf, 0) == 0) ? ATTR_EXISTS : ATTR_MISSING;
+		return attr;
 	}
 
-	strlcpy(file, path, sizeof(file));
-	strlcat(file, "/", sizeof(file));
-	strlcat(file, attr, sizeof(file));
+	fd = openat(dirfd, attr->name, O_RDONLY);
+	if (fd < 0) {
+		attr->state = (errno == ENOENT) ? ATTR_MISSING : ATTR_EXISTS;
+		return attr;
+	}
+	size = read(fd, attr->value, sizeof(attr->value) - 1);
+	close(fd);
+	if (size < 0) {
+		attr->state = ATTR_EXISTS;
+		return attr;
+	}
+	attr->value[size] = '\0';
+	remove_trailing_chars(attr->value, '\n');
+	attr->state = ATTR_VALUE;
+	return attr;
+}
 
-	if (match_value != NULL) {
-		/* match file content */
-		char value[NAME_SIZE];
-		int fd;
-		ssize_t size;
+static int attr_match(int dirfd, const struct trigger_filter *filter)
+{
+	struct attr_value *attr;
 
-		fd = open(file, O_RDONLY);
-		if (fd < 0)
-			return 0;
-		size = read(fd, value, sizeof(value));
-		close(fd);
-		if (size < 0)
-			return 0;
-		value[size] = '\0';
-		remove_trailing_chars(value, '\n');
+	attr = attr_get(dirfd, filter->attr, filter->value != NULL);
+	if (filter->value == NULL)
+		return attr->state != ATTR_MISSING;
+	if (attr->state != ATTR_VALUE)
+		return 0;
 
-		/* match if attribute value matches */
-		if (fnmatch(match_value, value, 0) == 0)
-			return 1;
-	} else {
-		/* match if attribute exists */
-		struct stat statbuf;
-
-		if (stat(file, &statbuf) == 0)
-			return 1;
-	}
-	return 0;
+	/* match if attribute value matches */
+	return pattern_match(filter->value, filter->value_glob, attr->value);
 }
 
 static int attr_filtered(const char *path)
 {
-	struct name_entry *loop_name;
+	struct trigger_filter *loop_filter;
+	int dirfd;
+	int i;
+	int filtered = 0;
+
+	if (list_empty(&filter_attr_nomatch_list) && list_empty(&filter_attr_match_list))
+		return 0;
+
+	/* all attributes are looked up relative to the device directory */
+	dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0)
+		return !list_empty(&filter_attr_match_list);
+	for (i = 0; i < attr_count; i++)
+		attr_snapshot[i].state = ATTR_UNKNOWN;
 
 	/* skip devices matching the listed sysfs attributes */
-	list_for_each_entry(loop_name, &filter_attr_nomatch_list, node)
-		if (attr_match(path, loop_name->name))
-			return 1;
+	list_for_each_entry(loop_filter, &filter_attr_nomatch_list, node)
+		if (attr_match(dirfd, loop_filter)) {
+			filtered = 1;
+			goto out;
+		}
 
 	/* skip devices not matching the listed sysfs attributes */
 	if (!list_empty(&filter_attr_match_list)) {
-		list_for_each_entry(loop_name, &filter_attr_match_list, node)
-			if (attr_match(path, loop_name->name))
-				return 0;
-		return 1;
+		filtered = 1;
+		list_for_each_entry(loop_filter, &filter_attr_match_list, node)
+			if (attr_match(dirfd, loop_filter)) {
+				filtered = 0;
+				break;
+			}
 	}
-	return 0;
+out:
+	close(dirfd);
+	return filtered;
 }
 
 enum scan_type {
@@ -409,6 +931,9 @@ int udevtrigger(int argc, char *argv[], char *envp[])
 	static const struct option options[] = {
 		{ "verbose", 0, NULL, 'v' },
 		{ "dry-run", 0, NULL, 'n' },
+		{ "jobs", 1, NULL, 'j' },
+		{ "snapshot", 1, NULL, 'p' },
+		{ "snapshot-save", 0, NULL, 'P' },
 		{ "help", 0, NULL, 'h' },
 		{ "action", 1, NULL, 'c' },
 		{ "subsystem-match", 1, NULL, 's' },
@@ -423,7 +948,7 @@ int udevtrigger(int argc, char *argv[], char *envp[])
 	sysfs_init();
 
 	while (1) {
-		option = getopt_long(argc, argv, "vnhc:s:S:a:A:", options, NULL);
+		option = getopt_long(argc, argv, "vnj:p:Phc:s:S:a:A:", options, NULL);
 		if (option == -1)
 			break;
 
@@ -434,25 +959,47 @@ int udevtrigger(int argc, char *argv[], char *envp[])
 		case 'n':
 			dry_run = 1;
 			break;
+		case 'j':
+			jobs = strtoul(optarg, NULL, 0);
+			if (jobs < 1)
+				jobs = 1;
+			break;
+		case 'p':
+			snapshot_file = optarg;
+			break;
+		case 'P':
+			snapshot_save_only = 1;
+			break;
 		case 'c':
 			action = optarg;
 			break;
 		case 's':
-			name_list_add(&filter_subsystem_match_list, optarg, 0);
+			if (filter_add(&filter_subsystem_match_list, optarg, 0) != 0)
+				goto exit;
 			break;
 		case 'S':
-			name_list_add(&filter_subsystem_nomatch_list, optarg, 0);
+			if (filter_add(&filter_subsystem_nomatch_list, optarg, 0) != 0)
+				goto exit;
 			break;
 		case 'a':
-			name_list_add(&filter_attr_match_list, optarg, 0);
+			if (filter_add(&filter_attr_match_list, optarg, 1) != 0)
+				goto exit;
 			break;
 		case 'A':
-			name_list_add(&filter_attr_nomatch_list, optarg, 0);
+			if (filter_add(&filter_attr_nomatch_list, optarg, 1) != 0)
+				goto exit;
 			break;
 		case 'h':
 			printf("Usage: udevadm trigger OPTIONS\n"
 			       "  --verbose                       print the list of devices while running\n"
 			       "  --dry-run                       do not actually trigger the events\n"
+			       "  --jobs=<n>                      trigger independent devices in <n>\n"
+			       "                                  parallel processes\n"
+			       "  --snapshot=<file>               skip devices with an unchanged driver\n"
+			       "                                  since <file> was saved\n"
+			       "  --snapshot-save                 save the drivers of all devices to the\n"
+			       "                                  snapshot instead of triggering, once\n"
+			       "                                  the coldplug events are settled\n"
 			       "  --subsystem-match=<subsystem>   trigger devices from a matching subystem\n"
 			       "  --subsystem-nomatch=<subsystem> exclude devices from a matching subystem\n"
 			       "  --attr-match=<file[=<value>]>   trigger devices with a matching sysfs\n"
@@ -467,6 +1014,18 @@ int udevtrigger(int argc, char *argv[], char *envp[])
 		}
 	}
 
+	if (snapshot_save_only) {
+		/* a partial device set would replace the whole snapshot */
+		if (snapshot_file == NULL || !list_empty(&filter_subsystem_match_list) ||
+		    !list_empty(&filter_subsystem_nomatch_list) ||
+		    !list_empty(&filter_attr_match_list) || !list_empty(&filter_attr_nomatch_list)) {
+			fprintf(stderr, "--snapshot-save needs --snapshot and no filters\n");
+			goto exit;
+		}
+	} else if (snapshot_file != NULL && strcmp(action, "add") == 0) {
+		snapshot_load(snapshot_file);
+	}
+
 	{
 		char base[PATH_SIZE];
 		struct stat statbuf;
@@ -494,11 +1053,16 @@ int udevtrigger(int argc, char *argv[], char *envp[])
 		}
 	}
 
+	if (snapshot_save_only && !dry_run)
+		snapshot_save(snapshot_file);
+
 exit:
-	name_list_cleanup(&filter_subsystem_match_list);
-	name_list_cleanup(&filter_subsystem_nomatch_list);
-	name_list_cleanup(&filter_attr_match_list);
-	name_list_cleanup(&filter_attr_nomatch_list);
+	snapshot_cleanup();
+	filter_cleanup(&filter_subsystem_match_list);
+	filter_cleanup(&filter_subsystem_nomatch_list);
+	filter_cleanup(&filter_attr_match_list);
+	filter_cleanup(&filter_attr_nomatch_list);
+	free(attr_snapshot);
 
 	sysfs_cleanup();
 	logging_close();
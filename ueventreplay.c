@@ -0,0 +1,340 @@
+/*
+    ueventreplay.c
+
+    Feeds uevents recorded with "udevmonitor --record" into the hotplug
+    dispatcher and reports how long every event took to be handled.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License 2.0 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "hotplug.h"
+#include "hotplug_uevent.h"
+#include "hotplug_util.h"
+#include "udev.h"
+#include "udevd.h"
+#include "ueventreplay.h"
+
+/* the kernel does not limit the number of concurrent helpers either */
+#define REPLAY_MAX_CHILDREN	256
+
+struct replay_child {
+	pid_t pid;
+	unsigned long long start;
+	char *event;
+};
+
+static struct replay_child children[REPLAY_MAX_CHILDREN];
+static unsigned int running;
+static unsigned int max_running = REPLAY_MAX_CHILDREN;
+
+static unsigned long long *latencies;
+static size_t latency_count;
+static size_t latency_size;
+static unsigned int failed;
+static int quiet;
+
+static unsigned long long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void child_done(pid_t pid, int status)
+{
+	struct replay_child *child = NULL;
+	unsigned long long usec;
+	unsigned int i;
+
+	for (i = 0; i < REPLAY_MAX_CHILDREN; i++) {
+		if (children[i].pid == pid) {
+			child = &children[i];
+			break;
+		}
+	}
+	if (child == NULL)
+		return;
+
+	usec = now_usec() - child->start;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failed++;
+
+	if (latency_count == latency_size) {
+		latency_size = latency_size ? latency_size * 2 : 1024;
+		latencies = realloc(latencies, latency_size * sizeof(latencies[0]));
+		if (latencies == NULL) {
+			latency_size = 0;
+			latency_count = 0;
+		}
+	}
+	if (latencies != NULL)
+		latencies[latency_count++] = usec;
+
+	if (!quiet)
+		printf("%8llu.%03llu ms  %-3i %s\n", usec / 1000, usec % 1000,
+		       WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status),
+		       child->event ? child->event : "");
+
+	free(child->event);
+	child->event = NULL;
+	child->pid = 0;
+	running--;
+}
+
+static void reap_children(int block)
+{
+	pid_t pid;
+	int status;
+
+	while (running > 0) {
+		pid = waitpid(-1, &status, block ? 0 : WNOHANG);
+		if (pid <= 0)
+			break;
+		child_done(pid, status);
+		block = 0;
+	}
+}
+
+/* reap children until the deadline passes, SIGCHLD is blocked */
+static void wait_until(unsigned long long deadline)
+{
+	struct timespec ts;
+	unsigned long long now;
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	for (;;) {
+		reap_children(0);
+		now = now_usec();
+		if (now >= deadline)
+			break;
+		ts.tv_sec = (deadline - now) / 1000000;
+		ts.tv_nsec = (deadline - now) % 1000000 * 1000;
+		sigtimedwait(&mask, NULL, &ts);
+	}
+}
+
+static void replay_event(char *buf, size_t len, const char *sysfs)
+{
+	struct replay_child *child = NULL;
+	const char *subsystem;
+	struct uevent ev;
+	unsigned int i;
+	pid_t pid;
+
+	if (uevent_parse(&ev, buf, len) < 0)
+		return;
+	subsystem = ev.known[UEVENT_SUBSYSTEM];
+	if (subsystem == NULL)
+		return;
+
+	while (running >= max_running)
+		reap_children(1);
+	for (i = 0; i < REPLAY_MAX_CHILDREN; i++) {
+		if (children[i].pid == 0) {
+			child = &children[i];
+			break;
+		}
+	}
+
+	fflush(stdout);
+	child->start = now_usec();
+	pid = fork();
+	switch (pid) {
+	case 0:
+		/* the environment of a kernel usermode helper */
+		clearenv();
+		setenv("HOME", "/", 1);
+		setenv("PATH", "/sbin:/bin:/usr/sbin:/usr/bin", 1);
+		if (sysfs != NULL)
+			setenv("SYSFS_PATH", sysfs, 1);
+		for (i = 0; i < ev.count; i++)
+			putenv((char *)ev.vars[i].key);
+		hotplug_dry_run = true;
+		_exit(hotplug_dispatch(subsystem, &ev));
+	case -1:
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		failed++;
+		return;
+	default:
+		child->pid = pid;
+		child->event = strdup(ev.header ? ev.header : "");
+		running++;
+	}
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	unsigned long long la = *(const unsigned long long *)a;
+	unsigned long long lb = *(const unsigned long long *)b;
+
+	return (la > lb) - (la < lb);
+}
+
+static unsigned long long percentile(unsigned int p)
+{
+	return latencies[(latency_count - 1) * p / 100];
+}
+
+static void print_summary(unsigned long long usec)
+{
+	unsigned long long sum = 0;
+	size_t i;
+
+	fflush(stdout);
+	fprintf(stderr, "%zu events in %llu.%03llu s, %u exited with an error\n",
+		latency_count, usec / 1000000, usec / 1000 % 1000, failed);
+	if (latency_count == 0)
+		return;
+
+	qsort(latencies, latency_count, sizeof(latencies[0]), latency_cmp);
+	for (i = 0; i < latency_count; i++)
+		sum += latencies[i];
+
+	fprintf(stderr, "latency usec: min %llu, avg %llu, p50 %llu, p95 %llu, p99 %llu, max %llu\n",
+		latencies[0], sum / latency_count, percentile(50), percentile(95),
+		percentile(99), latencies[latency_count - 1]);
+}
+
+int ueventreplay(int argc, char *argv[], char *envp[])
+{
+	static char buf[UEVENT_BUFFER_SIZE * 2];
+	struct uevent_record record;
+	unsigned long long first = 0;
+	unsigned long long start;
+	const char *sysfs = NULL;
+	double speed = 1.0;
+	sigset_t mask;
+	FILE *f;
+	int option;
+	int retval = 1;
+
+	static const struct option options[] = {
+		{ "speed", 1, NULL, 's' },
+		{ "max", 0, NULL, 'm' },
+		{ "jobs", 1, NULL, 'j' },
+		{ "sysfs", 1, NULL, 'S' },
+		{ "quiet", 0, NULL, 'q' },
+		{ "help", 0, NULL, 'h' },
+		{}
+	};
+
+	while (1) {
+		option = getopt_long(argc, argv, "s:mj:S:qh", options, NULL);
+		if (option == -1)
+			break;
+
+		switch (option) {
+		case 's':
+			speed = strtod(optarg, NULL);
+			if (speed <= 0.0) {
+				fprintf(stderr, "invalid speed '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			speed = 0.0;
+			break;
+		case 'j':
+			max_running = strtoul(optarg, NULL, 0);
+			if (max_running == 0 || max_running > REPLAY_MAX_CHILDREN)
+				max_running = REPLAY_MAX_CHILDREN;
+			break;
+		case 'S':
+			sysfs = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'h':
+			printf("Usage: ueventreplay [--speed=<factor>|--max] [--jobs=<n>] [--sysfs=<dir>]\n"
+			       "                    [--quiet] [--help] <file>\n"
+			       "  --speed=<factor>  replay faster (> 1) or slower (< 1) than recorded\n"
+			       "  --max             do not wait between events\n"
+			       "  --jobs=<n>        handle at most n events at the same time\n"
+			       "  --sysfs=<dir>     pass SYSFS_PATH=dir to the handlers\n"
+			       "  --quiet           print only the summary\n"
+			       "  --help\n"
+			       "Events are handled in dry run mode, \"-\" reads from stdin.\n\n");
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "missing recording, see --help\n");
+		return 1;
+	}
+
+	if (strcmp(argv[optind], "-") == 0)
+		f = stdin;
+	else
+		f = fopen(argv[optind], "r");
+	if (f == NULL) {
+		fprintf(stderr, "unable to open '%s': %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	start = now_usec();
+	while (fread(&record, sizeof(record), 1, f) == 1) {
+		if (record.size >= sizeof(buf)) {
+			fprintf(stderr, "invalid record of %u bytes\n", record.size);
+			goto out;
+		}
+		if (fread(buf, record.size, 1, f) != 1) {
+			fprintf(stderr, "truncated record\n");
+			goto out;
+		}
+		buf[record.size] = '\0';
+
+		if (record.source != UEVENT_RECORD_KERNEL)
+			continue;
+
+		if (first == 0)
+			first = record.usec;
+		if (speed > 0.0 && record.usec > first)
+			wait_until(start + (unsigned long long)((record.usec - first) / speed));
+
+		replay_event(buf, record.size, sysfs);
+	}
+	retval = 0;
+
+out:
+	while (running > 0)
+		reap_children(1);
+	print_summary(now_usec() - start);
+
+	if (f != stdin)
+		fclose(f);
+	free(latencies);
+	return retval;
+}
@@ -0,0 +1,6 @@
+#ifndef HOTPLUG_UEVENTREPLAY_H
+#define HOTPLUG_UEVENTREPLAY_H
+
+int ueventreplay(int argc, char *argv[], char *envp[]);
+
+#endif